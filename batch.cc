@@ -0,0 +1,59 @@
+#include "batch.hh"
+#include "calibrationengine.hh"
+#include "session.hh"
+#include "properties.hh"
+#include "devicebackend.hh"
+#include <QElapsedTimer>
+#include <QTextStream>
+
+int runBatch(const QStringList& sessions, const QString& device, DeviceBackend* backend, int tableSize,
+				 double spacing, bool autoLimits)
+{
+	QTextStream cout(stdout);
+	QTextStream cerr(stderr);
+	int failures = 0;
+
+	for (const QString& path : sessions) {
+		SessionHeader header;
+		QVector<SessionEvent> events;
+		QString error;
+		if (!readSession(path, header, events, &error)) {
+			cerr << path << " : " << error << endl;
+			failures++;
+			continue;
+		}
+
+		QElapsedTimer clock;
+		clock.start();
+
+		CalibrationEngine engine;
+		startSession(engine, header);
+		engine.setResampleSpacing(spacing);
+		if (autoLimits) engine.setAutoLimits(true);
+		for (const SessionEvent& e : events) replayEvent(engine, e);
+		if (engine.state() == 2) engine.nextStep();
+
+		cout << "# " << path << " : " << events.size() << " events, " << clock.nsecsElapsed() / 1e6 << " ms" << endl;
+		if (engine.state() != 3) {
+			cerr << path << " : not enough control points for the linear calibration" << endl;
+			failures++;
+			continue;
+		}
+
+		PropertyWrites writes;
+		writes.area = engine.area();
+		writes.distortion = engine.distortion();
+		if (tableSize > 1) writes.table = engine.distortionTable(tableSize);
+		writes.tableEntries = writes.table.isEmpty() ? 0 : tableSize;
+
+		if (backend) {
+			if (!backend->write(device, writes)) failures++;
+		} else {
+			cout << areaCommand(device, writes.area) << endl;
+			cout << distortionCommand(device, writes.distortion) << endl;
+			if (writes.tableEntries > 0) cout << distortionTableCommand(device, writes.tableEntries, writes.table) << endl;
+			else cout << resetDistortionTableCommand(device) << endl;
+		}
+	}
+	return failures;
+}
@@ -0,0 +1,21 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <QStringList>
+
+class DeviceBackend;
+
+/* Calibration without GUI from sessions recorded with --record
+ * each session is replayed through the calibration engine, a session left
+ * during the distortion calibration is completed with the lines drawn so far
+ * the xinput commands are printed, or the properties are set on device
+ * with backend if it is not null
+ * tableSize : see CalibrationWidget::setDistortionTableSize
+ * spacing : see CalibrationEngine::setResampleSpacing
+ * autoLimits : search the border limits even if the session did not, see CalibrationEngine::setAutoLimits
+ * return the number of sessions that could not be calibrated
+ */
+int runBatch(const QStringList& sessions, const QString& device, DeviceBackend* backend, int tableSize,
+				 double spacing = 0.0, bool autoLimits = false);
+
+#endif // BATCH_H
@@ -0,0 +1,19 @@
+#-------------------------------------------------
+#
+# Benchmark of the least squares backends of lmath
+#
+#-------------------------------------------------
+
+CONFIG   -= qt
+CONFIG   += console
+
+TARGET = lmath-bench
+TEMPLATE = app
+
+LIBS += -lm
+
+SOURCES += lmath-bench.c \
+    ../lmath.c
+
+HEADERS  += \
+    ../lmath.h
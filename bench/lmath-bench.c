@@ -0,0 +1,93 @@
+/* Speed and accuracy of the least squares backends of lmath
+ *
+ * The problems have the shapes of the fits of the calibration :
+ * the line fit (m = 2, pixels) and the quartic fit (m = 5, [raw^4 ... 1])
+ * on the part of the screen covered by a border (raw in [0, width])
+ * The data is exact, so the error is the numerical error of the backend
+ *
+ * usage : lmath-bench [repetitions]
+ */
+#include "../lmath.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+
+static double now(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + 1e-9 * t.tv_nsec;
+}
+
+static void make_problem(int n, int m, double width, const double* truth,
+								 double* A, double* b)
+{
+	int i, k;
+	for (i = 0; i < n; ++i) {
+		double t = width * (i + 0.5) / n;
+		if (m == 2) t *= 1000.0; // pixels
+		A[i*m+m-1] = 1.0;
+		for (k = m-2; k >= 0; --k) A[i*m+k] = A[i*m+k+1] * t;
+		b[i] = polynomial_evaluate(m, truth, t);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	static const char* names[] = { "auto", "lu", "cholesky", "qr" };
+	static const double line[] = { 0.0009, 0.01 };
+	static const double quartic[] = { -3.0, 2.5, -0.8, 1.1, 0.002 };
+	static const struct { int m; double width; const double* truth; } shapes[] = {
+		{ 2, 1.0,  line },
+		{ 5, 0.15, quartic },
+		{ 5, 0.05, quartic },
+		{ 5, 0.01, quartic },
+	};
+	static const int sizes[] = { 50, 500, 5000 };
+
+	int reps = argc > 1 ? atoi(argv[1]) : 200;
+	unsigned s, z;
+	int method, r, i, k;
+
+	printf("%-6s %-2s %-6s %-9s %12s %12s\n", "n", "m", "width", "method", "us/solve", "rel error");
+
+	for (s = 0; s < sizeof shapes / sizeof shapes[0]; ++s) {
+		for (z = 0; z < sizeof sizes / sizeof sizes[0]; ++z) {
+			int n = sizes[z];
+			int m = shapes[s].m;
+			double* A = (double*)malloc(sizeof(double)*n*m);
+			double* b = (double*)malloc(sizeof(double)*n);
+			double* work = (double*)malloc(sizeof(double)*least_squares_method_workspace(n, m));
+			int* iwork = (int*)malloc(sizeof(int)*LEAST_SQUARES_METHOD_IWORKSPACE(n, m));
+			double x[5];
+
+			make_problem(n, m, shapes[s].width, shapes[s].truth, A, b);
+
+			for (method = LS_AUTO; method <= LS_QR; ++method) {
+				double t0, t1, err, ref;
+				r = 0;
+				t0 = now();
+				for (i = 0; i < reps; ++i)
+					r |= least_squares_method_ws(n, m, A, b, x, method, work, iwork);
+				t1 = now();
+
+				err = ref = 0.0;
+				for (k = 0; k < m; ++k) {
+					err += (x[k] - shapes[s].truth[k]) * (x[k] - shapes[s].truth[k]);
+					ref += shapes[s].truth[k] * shapes[s].truth[k];
+				}
+				printf("%-6d %-2d %-6g %-9s %12.3f ", n, m, shapes[s].width, names[method],
+						 1e6 * (t1 - t0) / reps);
+				if (r) printf("%12s\n", "failed");
+				else printf("%12.3e\n", sqrt(err / ref));
+			}
+
+			free(A);
+			free(b);
+			free(work);
+			free(iwork);
+		}
+	}
+	return 0;
+}
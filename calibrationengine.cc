@@ -0,0 +1,1042 @@
+#include "calibrationengine.hh"
+#include <QtConcurrent>
+#include <QThreadPool>
+#include <cstring>
+#include <algorithm>
+#include <cmath>
+
+// WCM_DISTORTION_Q of the patched driver
+#define DISTORTION_Q 20
+
+// below, the curves are indexed faster than a thread is woken up
+#define PARALLEL_FIT_POINTS 2048
+// lanes of solveFits() per task, and below, the lanes are solved faster than threads are woken up
+#define FIT_CHUNK 128
+#define PARALLEL_FIT_LANES 512
+
+// prefix sums per point and border : raw_x^0..8, y raw_x^0..4, y^2
+#define PREFIX_TERMS 15
+
+/* standard deviation of the tablet samples around the ruler, in pixels
+ * the default cost of a point in a border for searchBorderLimit() is its square : the residual
+ * of a straight point in the line fit is of the order of the noise, the polynomial fits the
+ * straight part as well as the line, so with this cost the straight points go to the line
+ * and only the points that the line misses by more than the noise go to the polynomial
+ */
+#define LIMIT_NOISE 0.1
+// the fewest points a fit can have in searchBorderLimit()
+#define LIMIT_MIN_POINTS 4
+// pixels searchBorderLimit() tries on each side of the limit, the window moves if the best is on its edge
+#define LIMIT_WINDOW 16
+// values per pixel of BorderIndex::lanes : a, b, the polynomial and the residuals in pixels^2,
+// NaN if not solved yet, infinite if a fit has too few points
+#define LIMIT_LANE 8
+
+CalibrationEngine::CalibrationEngine()
+{
+	m_w = 1.0;
+	m_h = 1.0;
+	m_rotation = 0;
+	m_state = 0;
+	m_spacing = 0.0;
+	m_autoLimits = false;
+	m_limitPenalty = LIMIT_NOISE * LIMIT_NOISE;
+	m_nextCurveId = 0;
+	m_drawing = false;
+	m_area << 0 << 0 << 10000 << 10000;
+	clearAll();
+}
+
+void CalibrationEngine::setScreenSize(double w, double h)
+{
+	m_w = w;
+	m_h = h;
+	updateLinearFit();
+}
+
+bool CalibrationEngine::nextStep()
+{
+	if (m_state == 0) {
+		m_state = 1;
+	} else if (m_state == 1) {
+		if (!linearCalibration()) return false;
+		m_state = 2;
+		clearAll();
+	} else if (m_state == 2) {
+		distortionCalibration();
+		m_state = 3;
+		clearAll();
+	} else {
+		return false;
+	}
+	return true;
+}
+
+void CalibrationEngine::tabletPress(const QPointF& pos, bool eraser)
+{
+	if (curveMode()) {
+		if (!eraser) {
+			Curve c;
+			resetCurve(c);
+			c.id = m_nextCurveId++;
+			m_curves.append(c);
+			m_drawing = true;
+		}
+	} else {
+		if (!eraser) {
+			if (m_raw_points.size() == m_phy_points.size()) {
+				m_phy_points << pos;
+			} else if (m_raw_points.size() < m_phy_points.size()) {
+				addRawPoint(pos);
+			}
+		} else {
+			removeLastPoint();
+		}
+	}
+}
+
+void CalibrationEngine::tabletMove(const QPointF& pos, qint64 time, bool eraser, bool limitHover, bool fit)
+{
+	if (m_phy_points.size() != m_raw_points.size()) return;
+
+	if (curveMode() && !limitHover) {
+		if (!eraser) {
+			// the pen moves above the tablet, the last curve is finished
+			if (!m_drawing) return;
+			// only the active curve changes, the others keep their fit
+			addCurvePoint(m_curves.last(), pos, time);
+			m_grid.insert(m_curves.last().id, pos);
+			if (fit) fitActiveCurve();
+		} else {
+			// the curves with a point near the eraser, from the cells around it
+			QVector<int> ids = m_grid.hits(pos, 7.0);
+			for (int id : ids) {
+				for (int i = 0; i < m_curves.size(); ++i) {
+					if (m_curves[i].id == id) {
+						removeCurve(i);
+						break;
+					}
+				}
+			}
+		}
+	}
+}
+
+void CalibrationEngine::fitActiveCurve()
+{
+	if (!fitMode() || m_curves.isEmpty()) return;
+	Curve& c = m_curves.last();
+	fitCurve(c);
+	int border = c.border;
+	if (m_autoLimits && border != -1 && searchBorderLimit(border)) fitBorder(border);
+}
+
+void CalibrationEngine::fitStaleCurves()
+{
+	if (!fitMode()) return;
+	QVector<int> stale;
+	for (int i = 0; i < m_curves.size(); ++i) {
+		if (m_curves[i].fitted != m_curves[i].pts.size()) stale << i;
+	}
+	// in their order, as their last tabletMove() would have
+	for (int i : stale) {
+		Curve& c = m_curves[i];
+		fitCurve(c);
+		int border = c.border;
+		if (m_autoLimits && border != -1 && searchBorderLimit(border)) fitBorder(border);
+	}
+}
+
+bool CalibrationEngine::tabletRelease()
+{
+	bool drawing = m_drawing;
+	m_drawing = false;
+	if (curveMode() && drawing) {
+		if (m_curves.last().pts.size() <= 20) {
+			removeCurve(m_curves.size() - 1);
+		} else {
+			return true;
+		}
+	}
+	return false;
+}
+
+void CalibrationEngine::undo()
+{
+	removeLastPoint();
+	if (m_curves.size() > 0) removeCurve(m_curves.size() - 1);
+}
+
+void CalibrationEngine::moveBorderLimit(int border, double pos, bool fit)
+{
+	m_borderLimits[border].move(pos);
+	if (fit) fitCurves();
+}
+
+void CalibrationEngine::applyFits(const CalibrationEngine& engine, bool all)
+{
+	if (m_autoLimits && engine.m_autoLimits) {
+		for (int border = 0; border < 4; ++border) m_borderLimits[border] = engine.m_borderLimits[border];
+	}
+
+	const QList<Curve>& fitted = engine.m_curves;
+	int first = all ? 0 : fitted.size() - 1;
+	for (int j = qMax(first, 0); j < fitted.size(); ++j) {
+		const Curve& f = fitted[j];
+
+		// by id, the curve may have been removed since
+		Curve* c = 0;
+		for (int i = 0; i < m_curves.size() && !c; ++i) if (m_curves[i].id == f.id) c = &m_curves[i];
+		if (!c) continue;
+
+		c->border = f.border;
+		memcpy(c->ab, f.ab, sizeof c->ab);
+		memcpy(c->poly, f.poly, sizeof c->poly);
+		c->fitted = f.fitted;
+
+		// the index built by the copy, and the rows of the points added since the copy after the others
+		c->sums = f.sums;
+		const CurvePoints& p = m_spacing > 0.0 ? c->samples : c->pts;
+		const CurvePoints& fp = m_spacing > 0.0 ? f.samples : f.pts;
+		for (int border = 0; border < 4; ++border) {
+			if (f.index[border].keys.size() == fp.size()) c->index[border] = f.index[border];
+		}
+		for (int k = fp.size(); k < p.size(); ++k) {
+			addFitRow(*c, p.at(k));
+			indexPoint(*c, k, p.at(k));
+		}
+	}
+}
+
+void CalibrationEngine::indexCurves()
+{
+	// one curve per task, its index is the same whatever the thread
+	int points = 0, curves = 0;
+	for (const Curve& c : m_curves) {
+		if (!isIndexed(c)) {
+			points += c.pts.size();
+			curves++;
+		}
+	}
+	if (points >= PARALLEL_FIT_POINTS && curves > 1 && QThreadPool::globalInstance()->maxThreadCount() > 1) {
+		QtConcurrent::blockingMap(m_curves, [this](Curve& c) { indexCurve(c); });
+	} else if (curves > 0) {
+		for (int i = 0; i < m_curves.size(); ++i) indexCurve(m_curves[i]);
+	}
+}
+
+void CalibrationEngine::fitCurves()
+{
+	/* the border limits moved : all the sums must be computed again,
+	 * from the index of the curves, built once per curve
+	 */
+	indexCurves();
+
+	QVector<int> fit;
+	QVector<const FitSums*> sums;
+	QVector<double> d;
+	for (int i = 0; i < m_curves.size(); ++i) {
+		Curve& c = m_curves[i];
+		for (int border = 0; border < 4; ++border) borderSums(c.index[border], border, m_borderLimits[border].pos, c.sums[border]);
+		c.fitted = c.pts.size();
+		if (selectBorder(c)) {
+			fit << i;
+			sums << &c.sums[c.border];
+			d << pixelToUnit(c.border, m_borderLimits[c.border].pos);
+		}
+	}
+	if (fit.isEmpty()) return;
+
+	// the fits of all the curves are solved in batch, one system per lane
+	QVector<double> ab, poly;
+	solveFits(sums, d, ab, poly);
+
+	int n = fit.size();
+	for (int s = 0; s < n; ++s) {
+		Curve& c = m_curves[fit[s]];
+		c.ab[0] = ab[s];
+		c.ab[1] = ab[n+s];
+		for (int i = 0; i < 5; ++i) c.poly[i] = poly[i*n+s];
+	}
+}
+
+/* The lanes are solved by chunks of FIT_CHUNK lanes, each one in its part of the storage, on all
+ * the cores when they are many : the chunks do not depend on the threads, nor do the fits
+ */
+void CalibrationEngine::solveFits(const QVector<const FitSums*>& sums, const QVector<double>& d, QVector<double>& ab, QVector<double>& poly)
+{
+	// unknowns of the line fit (a, b), of the polynomial and constraints of the polynomial
+	const int L = 2, P = 5, K = 3;
+
+	int n = sums.size();
+	ab.resize(L*n);
+	poly.resize(P*n);
+	if (n == 0) return;
+
+	// per lane : the normal equations of both fits, the constraints and the fits of the chunk
+	const int lane = L*L + L + P*P + P + K*P + K + L + P;
+	int chunk = qMin(n, FIT_CHUNK);
+	int chunks = (n + chunk - 1) / chunk;
+	int work_size = std::max(lmath::solve_ls_batch_workspace<L>(chunk),
+									 lmath::least_squares_constraint_normal_batch_workspace<P, K>(chunk));
+	int storage = lane * chunk + work_size;
+	m_storage.batch.resize(storage * chunks);
+
+	double* batch = m_storage.batch.data();
+	double* ab_all = ab.data();
+	double* poly_all = poly.data();
+	auto solveChunk = [&](int k) {
+		int first = k * chunk;
+		int m = qMin(chunk, n - first);
+		double* line_ata = batch + k * storage;
+		double* line_atb = line_ata + L*L*m;
+		double* poly_ata = line_atb + L*m;
+		double* poly_atb = poly_ata + P*P*m;
+		double* cons     = poly_atb + P*m;
+		double* crhs     = cons + K*P*m;
+		double* x_ab     = crhs + K*m;
+		double* x_poly   = x_ab + L*m;
+		double* work     = x_poly + P*m;
+
+		for (int s = 0; s < m; ++s) {
+			const ls_accumulator& line = sums[first+s]->line;
+			for (int i = 0; i < L*L; ++i) line_ata[i*m+s] = line.ATA[i];
+			for (int i = 0; i < L; ++i) line_atb[i*m+s] = line.ATb[i];
+		}
+		lmath::solve_ls_batch<L>(m, line_ata, line_atb, x_ab, work);
+
+		for (int s = 0; s < m; ++s) {
+			const ls_accumulator& acc = sums[first+s]->poly;
+			double lab[] = { x_ab[s], x_ab[m+s] };
+			double atb[P], C[K*P], e[K];
+			polynomialRhs(acc, lab, atb);
+			borderConstraint(d[first+s], C, e);
+			for (int i = 0; i < P*P; ++i) poly_ata[i*m+s] = acc.ATA[i];
+			for (int i = 0; i < P; ++i) poly_atb[i*m+s] = atb[i];
+			for (int i = 0; i < K*P; ++i) cons[i*m+s] = C[i];
+			for (int i = 0; i < K; ++i) crhs[i*m+s] = e[i];
+		}
+		lmath::least_squares_constraint_normal_batch<P, K>(m, poly_ata, poly_atb, cons, crhs, x_poly, work);
+
+		// value i of lane s at [i*n+s]
+		for (int s = 0; s < m; ++s) {
+			for (int i = 0; i < L; ++i) ab_all[i*n+first+s] = x_ab[i*m+s];
+			for (int i = 0; i < P; ++i) poly_all[i*n+first+s] = x_poly[i*m+s];
+		}
+	};
+
+	if (n >= PARALLEL_FIT_LANES && QThreadPool::globalInstance()->maxThreadCount() > 1) {
+		QVector<int> tasks(chunks);
+		for (int k = 0; k < chunks; ++k) tasks[k] = k;
+		QtConcurrent::blockingMap(tasks, [&](int& k) { solveChunk(k); });
+	} else {
+		for (int k = 0; k < chunks; ++k) solveChunk(k);
+	}
+}
+
+/* The cost of each position of the limit, for all the curves of the border at once :
+ * the sums of a curve for a position are a row of its index, and all the fits are
+ * solved in batch, one lane per position and curve
+ * the fits of a curve at a position do not depend on the other curves nor on the limit,
+ * they are kept in its index until it gets a point : each search solves the lanes of the
+ * active curve only, in the window around the limit
+ */
+bool CalibrationEngine::searchBorderLimit(int border)
+{
+	if (!fitMode()) return false;
+
+	int first, last;
+	limitRange(border, first, last);
+	if (first > last) return false;
+
+	QVector<int> curves;
+	for (int i = 0; i < m_curves.size(); ++i) {
+		if (m_curves[i].border == border) {
+			Curve& c = m_curves[i];
+			indexCurve(c);
+			BorderIndex& index = c.index[border];
+			if (index.lanes.size() != (last - first + 1) * LIMIT_LANE) index.lanes.fill(NAN, (last - first + 1) * LIMIT_LANE);
+			curves << i;
+		}
+	}
+	if (curves.isEmpty()) return false;
+
+	// the window goes the way the cost decreases, the lanes already solved are kept
+	const BorderLimit& limit = m_borderLimits[border];
+	double side = border < 2 ? 1.0 : -1.0;
+	int pos = qBound(first, qRound(limit.pos), last);
+	int lo = qMax(first, pos - LIMIT_WINDOW);
+	int hi = qMin(last, pos + LIMIT_WINDOW);
+	int dir = 0;
+	int best;
+	for (;;) {
+		solveLimitLanes(border, curves, lo, hi);
+
+		// the positions where all the fits have enough points
+		best = -1;
+		double best_cost = 0.0;
+		for (int x = lo; x <= hi; ++x) {
+			double cost = 0.0;
+			for (int j = 0; j < curves.size() && !std::isinf(cost); ++j) {
+				const BorderIndex& index = m_curves[curves[j]].index[border];
+				// the points in the border
+				int k = std::lower_bound(index.keys.constBegin(), index.keys.constEnd(), side * x) - index.keys.constBegin();
+				cost += index.lanes[(x - first) * LIMIT_LANE + 7] + m_limitPenalty * k;
+			}
+			if (!std::isinf(cost) && (best == -1 || cost < best_cost)) {
+				best = x;
+				best_cost = cost;
+			}
+		}
+
+		if (best == -1) {
+			// no position in the window, all of them are tried
+			if (lo == first && hi == last) return false;
+			lo = first;
+			hi = last;
+		} else if (best == lo && lo > first && dir <= 0) {
+			dir = -1;
+			hi = lo;
+			lo = qMax(first, lo - 2 * LIMIT_WINDOW);
+		} else if (best == hi && hi < last && dir >= 0) {
+			dir = 1;
+			lo = hi;
+			hi = qMin(last, hi + 2 * LIMIT_WINDOW);
+		} else {
+			break;
+		}
+	}
+
+	double old = limit.pos;
+	m_borderLimits[border].move(best);
+	return m_borderLimits[border].pos != old;
+}
+
+// every pixel between the edge and the bound of the limit
+void CalibrationEngine::limitRange(int border, int& first, int& last) const
+{
+	const BorderLimit& limit = m_borderLimits[border];
+	first = border < 2 ? 1 : int(std::floor(limit.limit)) + 1;
+	last = border < 2 ? int(std::ceil(limit.limit)) - 1 : int(wh(border)) - 1;
+}
+
+void CalibrationEngine::solveLimitLanes(int border, const QVector<int>& curves, int lo, int hi)
+{
+	int first, last;
+	limitRange(border, first, last);
+
+	// the sums of the lanes to solve, and where their fits go
+	QVector<double*> lanes;
+	QVector<double> d;
+	QVector<FitSums>& lane_sums = m_storage.lanes;
+	lane_sums.resize(0);
+	for (int x = lo; x <= hi; ++x) {
+		for (int i : curves) {
+			BorderIndex& index = m_curves[i].index[border];
+			// the lanes are written only if one is missing, they stay shared with the copies of the engine
+			if (!std::isnan(index.lanes.constData()[(x - first) * LIMIT_LANE + 7])) continue;
+			double* lane = index.lanes.data() + (x - first) * LIMIT_LANE;
+
+			FitSums sums;
+			borderSums(index, border, x, sums);
+			if (sums.line.rows < LIMIT_MIN_POINTS || sums.poly.rows < LIMIT_MIN_POINTS) {
+				lane[7] = INFINITY;
+				continue;
+			}
+			lane_sums << sums;
+			lanes << lane;
+			d << pixelToUnit(border, x);
+		}
+	}
+	int n = lanes.size();
+	if (n == 0) return;
+
+	QVector<const FitSums*> sums(n);
+	for (int s = 0; s < n; ++s) sums[s] = &lane_sums[s];
+	QVector<double> ab, poly;
+	solveFits(sums, d, ab, poly);
+
+	// residuals in unit^2, the rhs of the polynomial is the line a*y + b
+	double unit2 = wh(border) * wh(border);
+	for (int s = 0; s < n; ++s) {
+		const FitSums& f = lane_sums[s];
+		double* lane = lanes[s];
+		lane[0] = ab[s];
+		lane[1] = ab[n+s];
+		for (int i = 0; i < 5; ++i) lane[2+i] = poly[i*n+s];
+
+		ls_accumulator p = f.poly;
+		polynomialRhs(f.poly, lane, p.ATb);
+		p.btb = lane[0] * lane[0] * f.poly.btb + 2.0 * lane[0] * lane[1] * f.poly.ATb[4] + lane[1] * lane[1] * f.poly.rows;
+
+		lane[7] = (ls_accumulator_residual(&f.line, lane) + ls_accumulator_residual(&p, lane + 2)) * unit2;
+	}
+}
+
+/* Only the sums of the border change : the curves of the border are fitted again, with the
+ * lanes of searchBorderLimit() when it solved them, and the others only if their border changes
+ */
+void CalibrationEngine::fitBorder(int border)
+{
+	indexCurves();
+
+	int first, last;
+	limitRange(border, first, last);
+	double pos = m_borderLimits[border].pos;
+	// the lanes are solved at whole pixels
+	int lane = pos == std::floor(pos) && pos >= first && pos <= last ? int(pos) - first : -1;
+
+	QVector<int> fit;
+	QVector<const FitSums*> sums;
+	QVector<double> d;
+	for (int i = 0; i < m_curves.size(); ++i) {
+		Curve& c = m_curves[i];
+		int before = c.border;
+		bool stale = c.fitted != c.pts.size();
+		borderSums(c.index[border], border, pos, c.sums[border]);
+		c.fitted = c.pts.size();
+		if (!selectBorder(c)) continue;
+		if (c.border != border && c.border == before && !stale) continue;
+
+		const BorderIndex& index = c.index[c.border];
+		const double* l = lane != -1 && c.border == border && index.lanes.size() == (last - first + 1) * LIMIT_LANE
+							 ? index.lanes.constData() + lane * LIMIT_LANE : 0;
+		if (l && !std::isnan(l[7]) && !std::isinf(l[7])) {
+			memcpy(c.ab, l, sizeof c.ab);
+			memcpy(c.poly, l + 2, sizeof c.poly);
+		} else {
+			fit << i;
+			sums << &c.sums[c.border];
+			d << pixelToUnit(c.border, m_borderLimits[c.border].pos);
+		}
+	}
+	if (fit.isEmpty()) return;
+
+	QVector<double> ab, poly;
+	solveFits(sums, d, ab, poly);
+
+	int n = fit.size();
+	for (int s = 0; s < n; ++s) {
+		Curve& c = m_curves[fit[s]];
+		c.ab[0] = ab[s];
+		c.ab[1] = ab[n+s];
+		for (int i = 0; i < 5; ++i) c.poly[i] = poly[i*n+s];
+	}
+}
+
+void CalibrationEngine::CurvePoints::clear()
+{
+	x.resize(0);
+	y.resize(0);
+	time.resize(0);
+}
+
+void CalibrationEngine::CurvePoints::append(const QPointF& point, qint64 t)
+{
+	x.append(point.x());
+	y.append(point.y());
+	time.append(t);
+}
+
+void CalibrationEngine::resetCurve(Curve& c)
+{
+	c.pts.clear();
+	c.samples.clear();
+	c.arc = 0.0;
+	c.border = -1;
+	c.fitted = 0;
+	for (BorderIndex& index : c.index) {
+		index.keys.clear();
+		index.values.clear();
+		index.prefix.clear();
+		index.lanes.clear();
+	}
+	c.sums.resize(4);
+	for (FitSums& s : c.sums) {
+		ls_accumulator_init(&s.line, 2);
+		ls_accumulator_init(&s.poly, 5);
+	}
+}
+
+void CalibrationEngine::addCurvePoint(Curve& c, const QPointF& point, qint64 time)
+{
+	if (m_spacing <= 0.0) {
+		addFitRow(c, point);
+		indexPoint(c, c.pts.size(), point);
+		c.pts.append(point, time);
+		return;
+	}
+
+	// a sample every m_spacing pixels along the segment from the previous point
+	if (c.pts.isEmpty()) {
+		addFitRow(c, point);
+		indexPoint(c, c.samples.size(), point);
+		c.samples.append(point, time);
+	} else {
+		QPointF q = c.pts.last();
+		qint64 tq = c.pts.time.last();
+		double d = std::hypot(point.x() - q.x(), point.y() - q.y());
+		double t = m_spacing - c.arc; // to the next sample
+		while (t <= d) {
+			double a = t / d;
+			QPointF s = q + (point - q) * a;
+			addFitRow(c, s);
+			indexPoint(c, c.samples.size(), s);
+			c.samples.append(s, tq + qint64((time - tq) * a));
+			t += m_spacing;
+		}
+		c.arc = d - (t - m_spacing);
+	}
+	c.pts.append(point, time);
+}
+
+// add the point to the sums of the fits
+void CalibrationEngine::addFitRow(Curve& c, const QPointF& point)
+{
+	for (int border = 0; border < 4; ++border) {
+		double y = yx(border, point);
+		double raw = pixelToUnit(border, xy(border, point));
+
+		if (!isInBorder(border, point)) {
+			double row[] = { y, 1.0 };
+			ls_accumulator_add_row(&c.sums[border].line, row, raw);
+		} else {
+			double row[] = { raw*raw*raw*raw, raw*raw*raw, raw*raw, raw, 1.0 };
+			ls_accumulator_add_row(&c.sums[border].poly, row, y);
+		}
+	}
+}
+
+bool CalibrationEngine::isIndexed(const Curve& c) const
+{
+	int n = (m_spacing > 0.0 ? c.samples : c.pts).size();
+	for (int border = 0; border < 4; ++border) {
+		const BorderIndex& index = c.index[border];
+		if (index.prefix.size() != (n + 1) * PREFIX_TERMS || index.scale != 1.0 / wh(border)) return false;
+	}
+	return true;
+}
+
+/* Sort the points of the curve from the inside of each border and sum their
+ * terms in this order, then the sums for any limit are a row of the prefix sums
+ * (comments holds for TopX border)
+ */
+void CalibrationEngine::indexCurve(Curve& c) const
+{
+	const CurvePoints& pts = m_spacing > 0.0 ? c.samples : c.pts;
+	int n = pts.size();
+	QVector<int> order(n);
+
+	for (int border = 0; border < 4; ++border) {
+		BorderIndex& index = c.index[border];
+		double scale = 1.0 / wh(border);
+		if (index.prefix.size() == (n + 1) * PREFIX_TERMS && index.scale == scale) continue;
+
+		const double* u = border % 2 == 0 ? pts.x.constData() : pts.y.constData(); // x
+		const double* v = border % 2 == 0 ? pts.y.constData() : pts.x.constData(); // y
+		// in the border if side * x < side * pos
+		double side = border < 2 ? 1.0 : -1.0;
+
+		// the equal points stay in their order, the index does not depend on the sort
+		for (int i = 0; i < n; ++i) order[i] = i;
+		std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return side * u[a] < side * u[b]; });
+
+		index.scale = scale;
+		index.keys.resize(n);
+		index.values.resize(n);
+		for (int k = 0; k < n; ++k) {
+			index.keys[k] = side * u[order[k]];
+			index.values[k] = v[order[k]];
+		}
+		index.prefix.resize((n + 1) * PREFIX_TERMS);
+		index.lanes.clear();
+		prefixRows(index, border, 0);
+	}
+}
+
+/* the new point goes after the points with the same key, where the stable sort of indexCurve()
+ * puts it, and the rows after it are summed again in the same order : the index is the one
+ * indexCurve() would build
+ */
+void CalibrationEngine::indexPoint(Curve& c, int n, const QPointF& point) const
+{
+	for (int border = 0; border < 4; ++border) {
+		BorderIndex& index = c.index[border];
+		// not built, or for other points : built again when needed
+		if (index.keys.size() != n || index.prefix.size() != (n + 1) * PREFIX_TERMS || index.scale != 1.0 / wh(border)) continue;
+
+		double side = border < 2 ? 1.0 : -1.0;
+		double key = side * xy(border, point);
+		int k = std::upper_bound(index.keys.constBegin(), index.keys.constEnd(), key) - index.keys.constBegin();
+		index.keys.insert(k, key);
+		index.values.insert(k, yx(border, point));
+		index.prefix.resize((n + 2) * PREFIX_TERMS);
+		index.lanes.clear();
+		prefixRows(index, border, k);
+	}
+}
+
+void CalibrationEngine::prefixRows(BorderIndex& index, int border, int from)
+{
+	// raw_x = s0 + s1 * x, see pixelToUnit
+	double s0 = border < 2 ? 0.0 : 1.0;
+	double s1 = border < 2 ? index.scale : -index.scale;
+	double side = border < 2 ? 1.0 : -1.0;
+
+	int n = index.keys.size();
+	double* sum = index.prefix.data() + from * PREFIX_TERMS;
+	if (from == 0) for (int t = 0; t < PREFIX_TERMS; ++t) sum[t] = 0.0;
+
+	for (int k = from; k < n; ++k, sum += PREFIX_TERMS) {
+		double r = s0 + s1 * (side * index.keys[k]);
+		double y = index.values[k];
+
+		double* next = sum + PREFIX_TERMS;
+		double rk = 1.0;
+		LMATH_UNROLL
+		for (int j = 0; j < 9; ++j) {
+			next[j] = sum[j] + rk;
+			if (j < 5) next[9+j] = sum[9+j] + rk * y;
+			rk *= r;
+		}
+		next[14] = sum[14] + y * y;
+	}
+}
+
+void CalibrationEngine::borderSums(const BorderIndex& index, int border, double pos, FitSums& sums)
+{
+	double side = border < 2 ? 1.0 : -1.0;
+	int n = index.keys.size();
+
+	// the points in the border come first : p, the others are all but them : o
+	int k = std::lower_bound(index.keys.constBegin(), index.keys.constEnd(), side * pos) - index.keys.constBegin();
+	const double* p = index.prefix.constData() + k * PREFIX_TERMS;
+	const double* all = index.prefix.constData() + n * PREFIX_TERMS;
+	double o[PREFIX_TERMS];
+	for (int t = 0; t < PREFIX_TERMS; ++t) o[t] = all[t] - p[t];
+
+	// line : y^2, y, 1, y raw_x, raw_x, raw_x^2
+	ls_accumulator& line = sums.line;
+	ls_accumulator_init(&line, 2);
+	line.ATA[0] = o[14]; line.ATA[1] = o[9];
+	line.ATA[2] = o[9]; line.ATA[3] = o[0];
+	line.ATb[0] = o[10]; line.ATb[1] = o[1];
+	line.btb = o[2];
+	line.rows = o[0];
+
+	// rows [raw_x^4 raw_x^3 raw_x^2 raw_x 1] : A^t A is a Hankel matrix of the sums of the powers
+	ls_accumulator& poly = sums.poly;
+	ls_accumulator_init(&poly, 5);
+	for (int i = 0; i < 5; ++i) {
+		for (int j = 0; j < 5; ++j) poly.ATA[i*5+j] = p[8-i-j];
+		poly.ATb[i] = p[9+4-i];
+	}
+	poly.btb = p[14];
+	poly.rows = p[0];
+}
+
+bool CalibrationEngine::selectBorder(Curve& c)
+{
+	if ((m_spacing > 0.0 ? c.samples : c.pts).size() <= 3) return false;
+
+	// the curve belongs to a border if only this border contains some of its points
+	const QVector<FitSums>& sums = c.sums;
+	c.border = -1;
+	for (int border = 0; border < 4; ++border) {
+		if (sums[border].poly.rows > 0.0) {
+			int other;
+			for (other = border+1; other < 4; ++other) if (sums[other].poly.rows > 0.0) break;
+			if (other == 4) c.border = border;
+			break;
+		}
+	}
+	if (c.border == -1) return false;
+
+	// a line is needed in the straight part
+	if (sums[c.border].line.rows == 0.0) {
+		c.border = -1;
+		return false;
+	}
+	return true;
+}
+
+/* the polynomial fits phy_x = a*y + b, A^t phy_x = a A^t y + b A^t 1
+ * and A^t 1 is the last column of A^t A
+ */
+void CalibrationEngine::polynomialRhs(const ls_accumulator& poly, const double* ab, double* atb)
+{
+	for (int i = 0; i < 5; ++i) atb[i] = ab[0] * poly.ATb[i] + ab[1] * poly.ATA[i*5+4];
+}
+
+/* the polynomial joins the line at the border limit d
+ * with the same slope (1) and the same value (d), and has slope 1 in 0
+ */
+void CalibrationEngine::borderConstraint(double d, double* cons, double* crhs)
+{
+	double c[] = {
+		4.*d*d*d,      3.*d*d,      2.*d,      1.0,   0.0,
+		d*d*d*d,       d*d*d,       d*d,       d,     1.0,
+		0,             0,           0,         1.0,   0.0
+	};
+	double e[] = {
+		1.0,
+		d,
+		1.0
+	};
+	memcpy(cons, c, sizeof c);
+	memcpy(crhs, e, sizeof e);
+}
+
+void CalibrationEngine::fitCurve(Curve& c)
+{
+	c.fitted = c.pts.size();
+	if (!selectBorder(c)) return;
+
+	const FitSums& s = c.sums.at(c.border);
+	lmath::solve<2>(s.line, c.ab);
+
+	double atb[5], cons[3*5], crhs[3];
+	polynomialRhs(s.poly, c.ab, atb);
+	borderConstraint(pixelToUnit(c.border, m_borderLimits[c.border].pos), cons, crhs);
+	lmath::least_squares_constraint_normal<5, 3>(s.poly.ATA, atb, cons, crhs, c.poly);
+}
+
+void CalibrationEngine::clearAll()
+{
+	m_borderLimits[TopX].pos = 0.1 * m_w;
+	m_borderLimits[TopX].limit = 0.4 * m_w;
+	m_borderLimits[TopX].horizontal = false;
+
+	m_borderLimits[TopY].pos = 0.1 * m_h;
+	m_borderLimits[TopY].limit = 0.4 * m_h;
+	m_borderLimits[TopY].horizontal = true;
+
+	m_borderLimits[BottomX].pos = 0.9 * m_w;
+	m_borderLimits[BottomX].limit = 0.6 * m_w;
+	m_borderLimits[BottomX].horizontal = false;
+
+	m_borderLimits[BottomY].pos = 0.9 * m_h;
+	m_borderLimits[BottomY].limit = 0.6 * m_h;
+	m_borderLimits[BottomY].horizontal = true;
+
+	m_phy_points.clear();
+	m_raw_points.clear();
+	ls_accumulator_init(&m_linear[0], 2);
+	ls_accumulator_init(&m_linear[1], 2);
+	ls_accumulator_init(&m_affine[0], 3);
+	ls_accumulator_init(&m_affine[1], 3);
+	updateLinearFit();
+
+	m_curves.clear();
+	m_grid.clear();
+	m_drawing = false;
+}
+
+void CalibrationEngine::removeCurve(int index)
+{
+	if (index == m_curves.size() - 1) m_drawing = false;
+	m_grid.remove(m_curves[index].id);
+	m_curves.removeAt(index);
+}
+
+void CalibrationEngine::addRawPoint(const QPointF& raw)
+{
+	const QPointF& phy = m_phy_points[m_raw_points.size()];
+	m_raw_points << raw;
+
+	double row[] = { raw.x(), 1.0 };
+	ls_accumulator_add_row(&m_linear[0], row, phy.x());
+	row[0] = raw.y();
+	ls_accumulator_add_row(&m_linear[1], row, phy.y());
+
+	double affine[] = { raw.x(), raw.y(), 1.0 };
+	ls_accumulator_add_row(&m_affine[0], affine, phy.x());
+	ls_accumulator_add_row(&m_affine[1], affine, phy.y());
+	updateLinearFit();
+}
+
+void CalibrationEngine::removeRawPoint()
+{
+	QPointF raw = m_raw_points.takeLast();
+	const QPointF& phy = m_phy_points[m_raw_points.size()];
+
+	double row[] = { raw.x(), 1.0 };
+	ls_accumulator_remove_row(&m_linear[0], row, phy.x());
+	row[0] = raw.y();
+	ls_accumulator_remove_row(&m_linear[1], row, phy.y());
+
+	double affine[] = { raw.x(), raw.y(), 1.0 };
+	ls_accumulator_remove_row(&m_affine[0], affine, phy.x());
+	ls_accumulator_remove_row(&m_affine[1], affine, phy.y());
+	updateLinearFit();
+}
+
+void CalibrationEngine::removeLastPoint()
+{
+	if (m_phy_points.size() > 0) {
+		if (m_phy_points.size() == m_raw_points.size()) {
+			removeRawPoint();
+		} else {
+			m_phy_points.removeLast();
+		}
+	}
+}
+
+static void fix_area(double slope, double offset, double range, double old_min, double old_max, int& new_min, int& new_max)
+{
+	new_min = std::round(old_min - (old_max - old_min) * offset / (slope * range));
+	new_max = std::round((old_max - old_min) / slope) + new_min;
+}
+
+/* correction applied by the patched driver in wcmRotateAndScaleCoordinates
+ * f : coordinate in the tablet area, in [0,1]
+ * top, bottom : [border, x^4, x^3, x^2, x, 1]
+ */
+static double correct(double f, const double* top, const double* bottom)
+{
+	if (f < top[0]) f = polynomial_evaluate(5, top + 1, f);
+	if (1.0 - f < bottom[0]) f = 1.0 - polynomial_evaluate(5, bottom + 1, 1.0 - f);
+	return f;
+}
+
+/* the patched driver stores the distortion in fixed point with DISTORTION_Q fractional bits
+ * return the nearest value that is exactly both a float and such a fixed point number
+ */
+static double quantize(double value)
+{
+	float f = value;
+	return std::round(std::ldexp(double(f), DISTORTION_Q)) / (1 << DISTORTION_Q);
+}
+
+/* worst difference between the polynomial evaluated in double with the fitted values
+ * and evaluated in fixed point by the driver with the quantized values
+ * values : [border, x^4, x^3, x^2, x, 1]
+ */
+static double quantizationError(const QVector<double>& fit, const QVector<double>& quantized)
+{
+	const double one = 1 << DISTORTION_Q;
+	long long poly[5];
+	for (int i = 0; i < 5; ++i) poly[i] = std::llround(quantized[i + 1] * one);
+
+	double error = 0.0;
+	for (long long x = 0; x < std::llround(quantized[0] * one); ++x) {
+		double exact = polynomial_evaluate(5, fit.data() + 1, x / one);
+		double fixed = polynomial_evaluate_fixed(5, poly, x, DISTORTION_Q) / one;
+		error = std::max(error, std::abs(fixed - exact));
+	}
+	return error;
+}
+
+bool CalibrationEngine::linearCalibration()
+{
+	// solved as the points came
+	if (!m_linearFit.valid) return false;
+	m_area = m_linearFit.area;
+	return true;
+}
+
+void CalibrationEngine::updateLinearFit()
+{
+	LinearFit& f = m_linearFit;
+	int n = m_raw_points.size();
+	f.valid = false;
+	f.affineValid = false;
+	f.residuals.clear();
+	f.rms = 0.0;
+	f.affineRms = 0.0;
+	f.rotation = 0.0;
+	f.shear = 0.0;
+
+	double x[2], y[2];
+	if (n < 2 || lmath::solve<2>(m_linear[0], x) != 0 || lmath::solve<2>(m_linear[1], y) != 0) return;
+
+	QVector<int> old_area(4);
+	QVector<int> new_area(4);
+	old_area = m_area;
+	// TopX, TopY, BottomX, BottomY
+	for (int i = 0; i < m_rotation; ++i) old_area.prepend(old_area.takeLast());
+
+	// phy = res[0] * raw + res[1]
+	fix_area(x[0], x[1], m_w, old_area[TopX], old_area[BottomX], new_area[TopX], new_area[BottomX]);
+	fix_area(y[0], y[1], m_h, old_area[TopY], old_area[BottomY], new_area[TopY], new_area[BottomY]);
+
+	// TopX, TopY, BottomX, BottomY
+	for (int i = 0; i < m_rotation; ++i) new_area.append(new_area.takeFirst());
+
+	f.area = new_area;
+	f.valid = true;
+
+	// the points are few, their residuals are computed again
+	double ss = 0.0;
+	for (int i = 0; i < n; ++i) {
+		const QPointF& raw = m_raw_points[i];
+		QPointF r = m_phy_points[i] - QPointF(x[0] * raw.x() + x[1], y[0] * raw.y() + y[1]);
+		f.residuals << r;
+		ss += r.x() * r.x() + r.y() * r.y();
+	}
+	f.rms = std::sqrt(ss / n);
+
+	if (n < 3 || lmath::solve<3>(m_affine[0], f.affine) != 0 || lmath::solve<3>(m_affine[1], f.affine + 3) != 0) return;
+	f.affineValid = true;
+	f.affineRms = std::sqrt(qMax(0.0, ls_accumulator_residual(&m_affine[0], f.affine) +
+												ls_accumulator_residual(&m_affine[1], f.affine + 3)) / n);
+
+	// the directions of the axes of the tablet on the screen
+	double ax = std::atan2(f.affine[3], f.affine[0]);
+	double ay = std::atan2(-f.affine[1], f.affine[4]);
+	f.rotation = 0.5 * (ax + ay);
+	f.shear = ay - ax;
+}
+
+void CalibrationEngine::distortionCalibration()
+{
+	QVector<QVector<double>> values(4);
+	m_quantizationErrors.fill(0.0, 4);
+
+	for (int b : {TopX, TopY, BottomX, BottomY}) {
+		values[b] << 0.0 << 0.0 << 0.0 << 0.0 << 1.0 << 0.0;
+
+		// take only the last curve
+		for (int j = 0; j < m_curves.size(); ++j) {
+			if (m_curves[j].border == b) {
+				values[b][0] = pixelToUnit(b, m_borderLimits[b].pos);
+				for (int i = 0; i < 5; ++ i) {
+					values[b][i + 1] = m_curves[j].poly[i];
+				}
+			}
+		}
+
+		// the driver evaluates the polynomial in fixed point, give it values it can represent exactly
+		QVector<double> fit = values[b];
+		for (int i = 0; i < 6; ++i) values[b][i] = quantize(values[b][i]);
+		m_quantizationErrors[b] = quantizationError(fit, values[b]);
+	}
+
+	// TopX, TopY, BottomX, BottomY
+	for (int i = 0; i < m_rotation; ++i) values.append(values.takeFirst());
+
+	m_distortion.clear();
+	for (int b : {TopX, TopY, BottomX, BottomY}) m_distortion += values[b];
+}
+
+QVector<int> CalibrationEngine::distortionTable(int entries) const
+{
+	QVector<int> table;
+	if (m_distortion.size() != 4*6 || entries < 2) return table;
+
+	for (int axis : {TopX, TopY}) {
+		double top = m_area[axis];
+		double bottom = m_area[axis + 2];
+		for (int i = 0; i < entries; ++i) {
+			double f = correct(double(i) / (entries - 1), m_distortion.data() + axis*6, m_distortion.data() + (axis + 2)*6);
+			table << qRound(top + f * (bottom - top));
+		}
+	}
+	return table;
+}
+
+void CalibrationEngine::BorderLimit::move(double new_pos)
+{
+	if (pos < limit && new_pos < limit) pos = new_pos;
+	if (pos > limit && new_pos > limit) pos = new_pos;
+}
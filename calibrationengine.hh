@@ -0,0 +1,338 @@
+#ifndef CALIBRATIONENGINE_H
+#define CALIBRATIONENGINE_H
+
+#include <QPointF>
+#include <QList>
+#include <QVector>
+
+#include "lmath.hh"
+#include "strokegrid.hh"
+
+/*         Top Y
+*    +--------------+
+* Top|              |
+*  X |              | Bottom X
+*    |              |
+*    +--------------+
+*        Bottom Y
+*
+*
+*
+*     +-----------------------------+
+*     |                      |      |
+*     |                      |      |
+*     |                      |      |
+*     |                      |      |<-- Screen border
+*     |                      |      |
+*     |                      |      |
+*     |    Axis of Unit      |      |
+* <---1----------------------|------0
+*     |                      |      |
+*     +-----------------------------+
+*                            ^
+*                BorderLimit |
+*
+*/
+
+/* Calibration without any GUI : the control points, the curves, the border
+ * limits, the fits and the steps. CalibrationWidget feeds it with the
+ * tablet events and applies the results with xinput, the replay tool feeds
+ * it with a recorded session.
+ */
+class CalibrationEngine
+{
+public:
+	CalibrationEngine();
+
+	enum Border {
+		TopX = 0,
+		TopY = 1,
+		BottomX = 2,
+		BottomY = 3
+	};
+
+	/* 0 : setup, give the screen size, the area and the rotation
+	 * 1 : linear calibration with control points
+	 * 2 : distortion calibration with lines drawn along a ruler
+	 * 3 : test, the lines are not fitted anymore
+	 */
+	inline int state() const { return m_state; }
+
+	// go to the next state, return false if the current one needs more input
+	bool nextStep();
+
+	void setScreenSize(double w, double h);
+	// TopX, TopY, BottomX, BottomY in the tablet orientation
+	inline void setArea(const QVector<int>& area) { m_area = area; updateLinearFit(); }
+	inline void setRotation(int rotation) { m_rotation = rotation; updateLinearFit(); }
+
+	/* the fits get the points of the curves resampled every spacing pixels
+	 * along the curve, 0 to fit all the samples of the tablet (default)
+	 * set it before the curves are drawn
+	 */
+	inline void setResampleSpacing(double spacing) { m_spacing = spacing; }
+	inline double resampleSpacing() const { return m_spacing; }
+
+	inline double width() const { return m_w; }
+	inline double height() const { return m_h; }
+	inline int rotation() const { return m_rotation; }
+
+	// the area, fixed by the linear calibration when leaving state 1
+	inline const QVector<int>& area() const { return m_area; }
+
+	/* The linear calibration, updated at each control point of state 1
+	 * the driver scales each axis on its own : the area comes from one fit per axis,
+	 * phy = a*raw + b, the affine fit phy = A raw + t tells what it can not correct
+	 */
+	struct LinearFit {
+		bool valid; // the area is known, 2 points at least
+		QVector<int> area; // set when leaving state 1
+		QVector<QPointF> residuals; // of the control points with the area, phy - fit, pixels
+		double rms; // of the residuals, pixels
+
+		bool affineValid; // 3 points at least, not aligned
+		double affine[6]; // phy_x = [0] raw_x + [1] raw_y + [2], phy_y = [3] raw_x + [4] raw_y + [5]
+		double affineRms; // of the residuals of the affine fit, pixels
+		double rotation; // from the raw points to the physical ones, radians
+		double shear; // between the rotations of the y and x axes, radians
+	};
+	inline const LinearFit& linearFit() const { return m_linearFit; }
+
+	/* computed when leaving state 2, in the tablet orientation
+	 * 4x[border width, x^4, x^3, x^2, x, 1] quantized for the driver
+	 */
+	inline const QVector<double>& distortion() const { return m_distortion; }
+	// worst quantization error of each border of the screen, in [0,1] unit
+	inline const QVector<double>& quantizationErrors() const { return m_quantizationErrors; }
+
+	// the correction for entries evenly spaced raw coordinates per axis, in tablet units
+	QVector<int> distortionTable(int entries) const;
+
+	// border limits, control points and curves
+	void clearAll();
+
+	// the tablet events, eraser : eraser end or right button
+	void tabletPress(const QPointF& pos, bool eraser);
+	/* the points go to the last curve from its press to the release, the moves of the pen
+	 * above the tablet are ignored
+	 * time : of the sample in microseconds
+	 * limitHover : a border limit is under the pointer or grabbed, the pen does not draw
+	 * fit : fit the active curve now, else fitActiveCurve() is called later
+	 */
+	void tabletMove(const QPointF& pos, qint64 time, bool eraser, bool limitHover, bool fit = true);
+	// fit the curve being drawn with all its points
+	void fitActiveCurve();
+	// fit the curves that got points since their last fit
+	void fitStaleCurves();
+	// return true if a curve has been completed
+	bool tabletRelease();
+
+	// remove the last control point and the last curve
+	void undo();
+
+	// fit : fit all the curves now, else fitCurves() is called later
+	void moveBorderLimit(int border, double pos, bool fit = true);
+
+	/* automatic border limits : each fit of the active curve searches the limit of its border
+	 * and fits the curves of the border again if it moves
+	 */
+	inline void setAutoLimits(bool enabled) { m_autoLimits = enabled; }
+	inline bool autoLimits() const { return m_autoLimits; }
+	/* cost of a point in the border, in pixels^2, that makes the straight part as long as it can be :
+	 * a point goes to the polynomial when the line misses it by more than sqrt(penalty) pixels
+	 * by default the square of the noise of the samples, 0.1 pixel (see calibrationengine.cc)
+	 */
+	inline void setLimitPenalty(double penalty) { m_limitPenalty = penalty; }
+	inline double limitPenalty() const { return m_limitPenalty; }
+	/* move the limit of the border where the fits of its curves are the best : the position with
+	 * the smallest residuals of the line and the polynomial, in pixels^2, plus limitPenalty() per
+	 * point in the border (the straight part is as long as it can be, see calibrationengine.cc)
+	 * tried every pixel of a window around the limit, moved while the best is on its edge,
+	 * between the edge of the screen and the bound of the limit
+	 * the curves are not fitted again (see fitBorder), return true if the limit moved
+	 */
+	bool searchBorderLimit(int border);
+	// the limit of the border moved, fit again the curves it changes
+	void fitBorder(int border);
+
+	/* take the fits of the curves of engine, a copy of this one fitted
+	 * somewhere else (see FitWorker), all : all its curves, else only its last one
+	 * the points added since the copy are kept, their curve is left to fit again
+	 * with the automatic limits on both, the limits of engine are taken too
+	 */
+	void applyFits(const CalibrationEngine& engine, bool all);
+
+	struct BorderLimit {
+		double pos;
+		double limit;
+		bool horizontal;
+
+		void move(double new_pos);
+	};
+
+	/* Normal equations of the two fits of a curve for one border
+	 * (comments holds for TopX border)
+	 * the points outside the border feed the line fit phy_x = a*y + b
+	 * the points inside the border feed the polynomial fit phy_x = Poly(raw_x)
+	 */
+	struct FitSums {
+		ls_accumulator line; // rows [y 1], rhs phy_x
+		ls_accumulator poly; // rows [raw_x^4 raw_x^3 raw_x^2 raw_x 1], rhs y
+	};
+
+	// The points of a curve, one contiguous array per coordinate
+	struct CurvePoints {
+		QVector<double> x, y;
+		QVector<qint64> time; // microseconds
+
+		inline int size() const { return x.size(); }
+		inline bool isEmpty() const { return x.isEmpty(); }
+		inline QPointF at(int i) const { return QPointF(x[i], y[i]); }
+		inline QPointF last() const { return at(size() - 1); }
+
+		void clear();
+		void append(const QPointF& point, qint64 t);
+	};
+
+	/* The sums of the fits of a curve for one border, whatever its limit :
+	 * the points sorted from the inside of the border, and the prefix sums of their terms
+	 * the points in the border are the first ones, a binary search away
+	 * once built, each new point is inserted in order and the rows after it are summed again
+	 */
+	struct BorderIndex {
+		QVector<double> keys; // side * x, increasing, see isInBorder
+		QVector<double> values; // y of the points, in the order of keys
+		QVector<double> prefix; // row k : the sums of the first k points, see PREFIX_TERMS
+		double scale; // pixelToUnit(border, 1) - pixelToUnit(border, 0) when built
+		// fits of searchBorderLimit() per pixel (see LIMIT_LANE), emptied when the points change
+		QVector<double> lanes;
+	};
+
+	struct Curve {
+		CurvePoints pts;
+		int border;
+		int id; // in m_grid
+
+		// pts resampled for the fits, empty if resampleSpacing() is 0
+		CurvePoints samples;
+		double arc; // length of the curve after the last sample
+
+		// comments holds for TopX border
+		double ab[2]; // phy_x = a*y + b; y in pixels, phy_x [0,1] unit
+		double poly[5]; // order 4 polynomial phy_x = Poly(raw_x)
+
+		QVector<FitSums> sums; // one per border, updated at each new point
+		int fitted; // pts.size() at the last fit
+		BorderIndex index[4]; // built when the limits first move, then kept up to date
+	};
+
+	inline const BorderLimit& borderLimit(int border) const { return m_borderLimits[border]; }
+	inline const QVector<QPointF>& phyPoints() const { return m_phy_points; }
+	inline const QVector<QPointF>& rawPoints() const { return m_raw_points; }
+	inline const QList<Curve>& curves() const { return m_curves; }
+
+	// lines are drawn in states 2 and 3, fitted only in state 2
+	inline bool curveMode() const { return m_state >= 2; }
+	inline bool fitMode() const { return m_state == 2; }
+
+	inline double wh(int border) const {
+		return border % 2 == 0 ? m_w : m_h;
+	}
+	inline double xy(int border, const QPointF& point) const {
+		return border % 2 == 0 ? point.x() : point.y();
+	}
+	inline double yx(int border, const QPointF& point) const {
+		return border % 2 == 0 ? point.y() : point.x();
+	}
+	bool isInBorder(int border, const QPointF& point) const {
+		return (border < 2) ? xy(border, point) < m_borderLimits[border].pos
+												: xy(border, point) > m_borderLimits[border].pos;
+	}
+	double pixelToUnit(int border, double pixel) const {
+		return (border < 2) ? pixel / wh(border)
+												: 1.0 - pixel / wh(border);
+	}
+	double unitToPixel(int border, double unit) const {
+		return (border < 2) ? unit * wh(border)
+												: (1.0 - unit) * wh(border);
+	}
+
+	void fitCurves();
+
+private:
+	bool linearCalibration();
+	// solve the fits of the control points, after each rank-1 update of their normal equations
+	void updateLinearFit();
+	void distortionCalibration();
+
+	void addRawPoint(const QPointF& raw);
+	void removeRawPoint();
+	void removeLastPoint();
+	void removeCurve(int index);
+
+	void resetCurve(Curve& c);
+	void addCurvePoint(Curve& c, const QPointF& point, qint64 time);
+	void addFitRow(Curve& c, const QPointF& point);
+	// false if the index of the borders of the curve misses points
+	bool isIndexed(const Curve& c) const;
+	// sort the points of the curve for all the borders, thread safe for different curves
+	void indexCurve(Curve& c) const;
+	// index the curves that miss points, on all the cores when they are many
+	void indexCurves();
+	// insert the point n of the curve in the indexes built with its n first points
+	void indexPoint(Curve& c, int n, const QPointF& point) const;
+	// the prefix sums of the index after its row from, from its keys and values
+	static void prefixRows(BorderIndex& index, int border, int from);
+	// the sums of a curve for the limit of the border at pos, from its index
+	static void borderSums(const BorderIndex& index, int border, double pos, FitSums& sums);
+	bool selectBorder(Curve& c);
+	// d : the border limit, unit
+	static void borderConstraint(double d, double* cons, double* crhs);
+	static void polynomialRhs(const ls_accumulator& poly, const double* ab, double* atb);
+	void fitCurve(Curve& c);
+	/* the fits of sums.size() curves in batch, one per lane, d : the limits of their borders
+	 * value i of lane s at [i*n+s] of ab (2 values) and poly (5 values)
+	 */
+	void solveFits(const QVector<const FitSums*>& sums, const QVector<double>& d, QVector<double>& ab, QVector<double>& poly);
+	// the pixels searchBorderLimit() can place the limit of the border at
+	void limitRange(int border, int& first, int& last) const;
+	// solve the lanes of the curves from pixel lo to hi that are not in their index yet
+	void solveLimitLanes(int border, const QVector<int>& curves, int lo, int hi);
+
+	double m_w, m_h;
+	int m_rotation;
+	int m_state;
+	double m_spacing;
+
+	QVector<QPointF> m_phy_points;
+	QVector<QPointF> m_raw_points;
+	ls_accumulator m_linear[2]; // phy = a*raw + b for x and y
+	ls_accumulator m_affine[2]; // rows [raw_x raw_y 1], rhs phy_x and phy_y
+	LinearFit m_linearFit;
+
+	BorderLimit m_borderLimits[4];
+
+	// storage of the batched fits, not copied with the engine : a copy has its own
+	struct FitStorage {
+		FitStorage() {}
+		FitStorage(const FitStorage&) {}
+		FitStorage& operator=(const FitStorage&) { return *this; }
+
+		QVector<double> batch; // of solveFits()
+		QVector<FitSums> lanes; // of searchBorderLimit()
+	};
+	FitStorage m_storage;
+	bool m_autoLimits;
+	double m_limitPenalty; // see setLimitPenalty
+
+	QList<Curve> m_curves;
+	int m_nextCurveId;
+	bool m_drawing; // the last curve is being drawn, from tabletPress() to tabletRelease()
+	StrokeGrid m_grid; // the points of the curves, for the eraser
+
+	QVector<int> m_area;
+	QVector<double> m_distortion;
+	QVector<double> m_quantizationErrors;
+};
+
+#endif // CALIBRATIONENGINE_H
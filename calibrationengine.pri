@@ -0,0 +1,23 @@
+# GUI-free calibration engine : lmath, the fits and steps, the session
+# recordings and the xinput properties, shared by wacom-distortion and wacom-replay
+
+# the fits of the curves are spread over the cores
+QT += concurrent
+
+INCLUDEPATH += $$PWD
+DEPENDPATH += $$PWD
+
+SOURCES += \
+    $$PWD/lmath.c \
+    $$PWD/strokegrid.cc \
+    $$PWD/calibrationengine.cc \
+    $$PWD/session.cc \
+    $$PWD/properties.cc
+
+HEADERS += \
+    $$PWD/lmath.h \
+    $$PWD/lmath.hh \
+    $$PWD/strokegrid.hh \
+    $$PWD/calibrationengine.hh \
+    $$PWD/session.hh \
+    $$PWD/properties.hh
@@ -3,34 +3,45 @@
 #include <QGuiApplication>
 #include <QScreen>
 #include <QPainter>
-#include <QProcess>
 #include <QTextStream>
 #include <QInputDialog>
 #include <QPushButton>
 #include <QVBoxLayout>
 #include <QHBoxLayout>
 #include <QDebug>
+#include <cmath>
 
-extern "C" {
-#include "lmath.h"
-}
+// pixels around what is painted : the widest pen and the antialiasing
+#define PAINT_MARGIN 3
 
 CalibrationWidget::CalibrationWidget(const QString& dev, QWidget *parent) : QWidget(parent)
 {
 	m_device = dev;
+	m_queue = 0;
+	m_tableSize = 0;
+	m_cacheKey = dev;
+	m_useCache = true;
+
+	m_frameSamples = 0;
+	m_frames = 0;
+	m_samples = 0;
+	m_maxFrameSamples = 0;
+	connect(&m_fitter, &FitWorker::ready, this, &CalibrationWidget::fitsReady);
+	m_frameTimer.setTimerType(Qt::PreciseTimer);
+	m_frameTimer.setInterval(16);
+	connect(&m_frameTimer, &QTimer::timeout, this, &CalibrationWidget::frame);
 
 	m_screen = QGuiApplication::screens().value(0, nullptr);
 	if (m_screen) {
-		m_w = m_screen->size().width();
-		m_h = m_screen->size().height();
+		m_engine.setScreenSize(m_screen->size().width(), m_screen->size().height());
+		if (m_screen->refreshRate() > 0) m_frameTimer.setInterval(qMax(1, qRound(1000.0 / m_screen->refreshRate())));
 		connect(m_screen, &QScreen::geometryChanged, this, &CalibrationWidget::screenChanged);
 	}
 
+	m_stroking = false;
+	m_strokeDrawn = 0;
 	clearAll();
-	m_borliMode = true;
-	m_curveMode = false;
 	m_drawRuler = false;
-	m_state = 0;
 
 	QPalette pal = palette();
 	pal.setColor(QPalette::Window, Qt::white);
@@ -60,65 +71,83 @@ CalibrationWidget::CalibrationWidget(const QString& dev, QWidget *parent) : QWid
 
 CalibrationWidget::~CalibrationWidget()
 {
+	if (m_frames > 0) {
+		QTextStream cout(stdout);
+		cout << "Tablet samples : " << m_samples << " in " << m_frames << " frames of " << m_frameTimer.interval() << " ms"
+			  << ", " << double(m_samples) / m_frames << " per frame (max " << m_maxFrameSamples << ")"
+			  << ", " << m_samples - m_frames << " fits and repaints merged" << endl;
+	}
+	if (m_fitter.submitted() > 0) {
+		QTextStream cout(stdout);
+		cout << "Fits : " << m_fitter.submitted() << " requested, " << m_fitter.superseded() << " superseded" << endl;
+	}
+}
 
+void CalibrationWidget::setPropertyQueue(PropertyQueue* queue)
+{
+	if (m_queue) disconnect(m_queue, 0, this, 0);
+	m_queue = queue;
+	connect(m_queue, &PropertyQueue::finished, this, &CalibrationWidget::propertiesApplied);
 }
 
 void CalibrationWidget::mousePressEvent(QMouseEvent* event)
 {
 	Q_UNUSED(event);
-	if (m_borliMode) {
+	if (m_engine.fitMode()) {
 		bool grab = false;
-		for (BorderLimit& elem : m_borderLimits) {
-			if (elem.state == 1) {
-				elem.state = 2;
+		for (int b = 0; b < 4; ++b) {
+			if (m_limitState[b] == 1) {
+				m_limitState[b] = 2;
+				invalidateLayer(dirtyRect(limitRect(b)));
 				grab = true;
 			}
 		}
 
 		if (grab) {
 			setCursor(QCursor(Qt::ClosedHandCursor));
-			update();
+			// the fits still in the worker are done here, then the user places the limits
+			if (m_engine.autoLimits()) {
+				m_engine.fitStaleCurves();
+				m_engine.setAutoLimits(false);
+				m_recorder.autoLimits(false);
+				invalidateLayer();
+			}
 		}
 	}
 }
 
 void CalibrationWidget::mouseMoveEvent(QMouseEvent* event)
 {
-	if (m_borliMode) {
+	if (m_engine.fitMode()) {
 		if (event->buttons() == 0) {
-			bool mouseCome = false;
-			bool mouseLeave = false;
 			bool mouseOver = false;
-			for (BorderLimit& elem : m_borderLimits) {
+			for (int b = 0; b < 4; ++b) {
+				const CalibrationEngine::BorderLimit& elem = m_engine.borderLimit(b);
 				int d = std::abs((elem.horizontal ? event->globalY() : event->globalX()) - elem.pos);
-				if (d <= 5) {
-					elem.state = 1;
-					mouseCome = true;
-				}
-				if (elem.state == 1 && d > 5) {
-					elem.state = 0;
-					mouseLeave = true;
-				}
-				if (elem.state == 1) mouseOver = true;
+				int state = m_limitState[b];
+				if (d <= 5) m_limitState[b] = 1;
+				if (m_limitState[b] == 1 && d > 5) m_limitState[b] = 0;
+				if (m_limitState[b] == 1) mouseOver = true;
+
+				// the pen of the limit changes
+				if (m_limitState[b] != state) invalidateLayer(dirtyRect(limitRect(b)));
 			}
 			if (mouseOver) setCursor(QCursor(Qt::OpenHandCursor));
 			else setCursor(QCursor(Qt::CrossCursor));
-
-			if (mouseCome || mouseLeave) update();
 		}
 
 		if (event->buttons() != 0) {
-			bool limitMoved = false;
-			for (BorderLimit& elem : m_borderLimits) {
-				if (elem.state == 2) {
-					elem.move(elem.horizontal ? event->globalY() : event->globalX());
-					limitMoved = true;
+			for (int b = 0; b < 4; ++b) {
+				if (m_limitState[b] == 2) {
+					double pos = m_engine.borderLimit(b).horizontal ? event->globalY() : event->globalX();
+					// all the curves are fitted again, in the worker
+					QRegion dirty = dirtyRect(limitRect(b));
+					m_recorder.limitMove(b, pos);
+					m_engine.moveBorderLimit(b, pos, false);
+					invalidateLayer(dirty + dirtyRect(limitRect(b)));
+					m_fitter.submit(m_engine, true);
 				}
 			}
-			if (limitMoved) {
-				fitCurves();
-				update();
-			}
 		}
 	}
 }
@@ -126,10 +155,10 @@ void CalibrationWidget::mouseMoveEvent(QMouseEvent* event)
 void CalibrationWidget::mouseReleaseEvent(QMouseEvent* event)
 {
 	Q_UNUSED(event);
-	if (m_borliMode) {
-		for (BorderLimit& elem : m_borderLimits) {
-			if (elem.state == 2) {
-				elem.state = 1;
+	if (m_engine.fitMode()) {
+		for (int& state : m_limitState) {
+			if (state == 2) {
+				state = 1;
 				setCursor(QCursor(Qt::OpenHandCursor));
 			}
 		}
@@ -138,213 +167,416 @@ void CalibrationWidget::mouseReleaseEvent(QMouseEvent* event)
 
 void CalibrationWidget::tabletEvent(QTabletEvent *event)
 {
-	bool eraser = event->pointerType() == QTabletEvent::Eraser || event->buttons() == Qt::RightButton;
+	SessionEvent e;
+	e.type = -1;
+	if (e.type == SessionEvent::TabletPress) e.type = SessionEvent::TabletPress;
+	if (e.type == SessionEvent::TabletMove) e.type = SessionEvent::TabletMove;
+	if (e.type == SessionEvent::TabletRelease) e.type = SessionEvent::TabletRelease;
+	if (e.type == -1) return;
+	e.time = qint64(event->timestamp()) * 1000;
+	e.pos = event->globalPosF();
+	e.pointer = event->pointerType();
+	e.buttons = event->buttons();
+	e.flags = 0;
+	e.border = 0;
+
+	// while a step is applied the device may still use the previous area : the samples
+	// wait for the result, see propertiesApplied()
+	if (m_queue && m_queue->busy()) {
+		m_pendingSamples << e;
+		return;
+	}
+	tabletSample(e);
+}
 
-	if (event->type() == QEvent::TabletPress) {
-		if (m_curveMode) {
-			if (!eraser) {
-				Curve c;
-				c.border = -1;
-				m_curves.append(c);
-			}
-		} else {
+void CalibrationWidget::tabletSample(const SessionEvent& e)
+{
+	bool eraser = e.eraser();
+
+	bool limitAboutMoving = false;
+	for (int state : m_limitState) {
+		if (state >= 1) limitAboutMoving = true;
+	}
+
+	m_recorder.tablet(e.type, e.pos, e.pointer, e.buttons, limitAboutMoving ? SessionEvent::LimitHover : 0);
+
+	if (e.type == SessionEvent::TabletPress) {
+		QRectF before = pointsRect();
+		m_engine.tabletPress(e.pos, eraser);
+		if (m_engine.curveMode() && !eraser) {
+			// nothing to paint until the curve has a segment
+			m_stroking = true;
+			if (!m_strokeLayer.isNull()) m_strokeLayer.fill(Qt::transparent);
+			m_strokeDrawn = 0;
+			m_strokeBounds = pointRect(e.pos);
+			m_strokeFitRect = QRectF();
+		}
+
+		if (!m_engine.curveMode()) {
+			invalidateLayer(dirtyRect(before | pointsRect()));
+
+			// a physical point waits for its raw point
+			bool waiting = m_engine.phyPoints().size() > m_engine.rawPoints().size();
 			if (!eraser) {
-				if (m_raw_points.size() == m_phy_points.size()) {
-					m_phy_points << event->globalPosF();
+				if (waiting) {
 					setCursor(QCursor(Qt::BlankCursor));
-
 					m_text->setText("Now tap the more precisely in the center of the circle");
-				} else if (m_raw_points.size() < m_phy_points.size()) {
-					m_raw_points << event->globalPosF();
+				} else {
 					setCursor(QCursor(Qt::CrossCursor));
-
-					m_text->setText("Add other control points or press Ok if you think you have enough points");
-				}
-			} else {
-				if (m_phy_points.size() > 0) {
-					if (m_phy_points.size() == m_raw_points.size()) {
-						m_raw_points.removeLast();
-						setCursor(QCursor(Qt::BlankCursor));
-					} else {
-						m_phy_points.removeLast();
-						setCursor(QCursor(Qt::CrossCursor));
+					QString text = "Add other control points or press Ok if you think you have enough points";
+					const CalibrationEngine::LinearFit& fit = m_engine.linearFit();
+					if (fit.valid) {
+						text += QString("\nWacom Tablet Area : %1 %2 %3 %4, residuals %5 pixels")
+								.arg(fit.area[0]).arg(fit.area[1]).arg(fit.area[2]).arg(fit.area[3]).arg(fit.rms, 0, 'f', 1);
+					}
+					if (fit.affineValid) {
+						text += QString("\nwith rotation and shear : residuals %1 pixels, rotation %2 degrees, shear %3 degrees")
+								.arg(fit.affineRms, 0, 'f', 1)
+								.arg(fit.rotation * 180.0 / M_PI, 0, 'f', 2).arg(fit.shear * 180.0 / M_PI, 0, 'f', 2);
 					}
+					m_text->setText(text);
 				}
+			} else {
+				setCursor(QCursor(waiting ? Qt::BlankCursor : Qt::CrossCursor));
 				m_text->clear();
 			}
 		}
 	}
 
-	if (event->type() == QEvent::TabletMove) {
-		if (m_phy_points.size() != m_raw_points.size()) return;
-
-		bool limitAboutMoving = false;
-		for (BorderLimit& elem : m_borderLimits) {
-			if (elem.state >= 1) limitAboutMoving = true;
-		}
-
-		if (m_curveMode && !limitAboutMoving) {
-			if (!eraser) {
-				m_curves.last().pts.append(event->globalPosF());
-				if (m_borliMode) fitCurves();
-			} else {
-				for (int i = 0; i < m_curves.size(); ++i) {
-					for (int j = 0; j < m_curves[i].pts.size(); ++j) {
-						if ((m_curves[i].pts[j] - event->globalPosF()).manhattanLength() <= 7) {
-							m_curves.removeAt(i);
-							i--;
-							break;
-						}
-					}
+	if (e.type == SessionEvent::TabletMove) {
+		if (m_stroking && !eraser) {
+			// the point is added now, fitted and painted with the next frame
+			int points = m_engine.curves().last().pts.size();
+			m_engine.tabletMove(e.pos, e.time, eraser, limitAboutMoving, false);
+
+			const CalibrationEngine::Curve& c = m_engine.curves().last();
+			if (c.pts.size() > points) {
+				QRectF segment = pointRect(c.pts.last());
+				if (points > 0) segment |= pointRect(c.pts.at(points-1));
+				m_strokeBounds |= segment;
+				m_frameDirty += dirtyRect(segment);
+				m_frameSamples++;
+
+				// the first sample after an idle frame does not wait
+				if (!m_frameTimer.isActive()) {
+					frame();
+					m_frameTimer.start();
 				}
 			}
+		} else if (eraser && m_engine.curveMode()) {
+			int curves = m_engine.curves().size();
+			QRegion before = curvesRegion();
+			m_engine.tabletMove(e.pos, e.time, eraser, limitAboutMoving);
+			if (m_engine.curves().size() != curves) invalidateLayer(before);
+		} else {
+			m_engine.tabletMove(e.pos, e.time, eraser, limitAboutMoving);
 		}
 	}
 
-	if (event->type() == QEvent::TabletRelease) {
-		if (m_curveMode && !m_curves.isEmpty()) {
-			if (m_curves.last().pts.size() <= 20) {
-				m_curves.removeLast();
-			} else if (m_state == 2) {
-				if (m_drawRuler) {
-					m_drawRuler = false;
-					m_text->setText("Move the border limit to separate the strait and the distorted part of your line\n"
+	if (e.type == SessionEvent::TabletRelease) {
+		// the last samples are fitted before the curve is completed
+		frame();
+		if (m_stroking) {
+			// the curve goes in the layer, or is dropped if too short
+			invalidateLayer(QRegion(dirtyRect(m_strokeBounds)) + dirtyRect(m_strokeFitRect));
+			m_stroking = false;
+		}
+		if (m_engine.tabletRelease() && m_engine.state() == 2) {
+			if (m_drawRuler) {
+				invalidateLayer(dirtyRect(rulerRect()));
+				m_drawRuler = false;
+				if (m_engine.autoLimits()) {
+					m_text->setText("The border limit separates the strait and the distorted part of your line, move it to place it yourself\n"
 													"Then repeat the procedure for the other borders");
 				} else {
-					m_text->setText("Only the last line of each border is taken in account\n"
-													"Press Ok when you have finished");
+					m_text->setText("Move the border limit to separate the strait and the distorted part of your line\n"
+													"Then repeat the procedure for the other borders");
 				}
+			} else {
+				m_text->setText("Only the last line of each border is taken in account\n"
+												"Press Ok when you have finished");
 			}
 		}
 	}
 
-	update();
 }
 
 void CalibrationWidget::paintEvent(QPaintEvent* event)
 {
-	Q_UNUSED(event);
+	qreal ratio = devicePixelRatioF();
+	QSize size = this->size() * ratio;
+	if (m_layer.size() != size) {
+		m_layer = QPixmap(size);
+		m_layer.setDevicePixelRatio(ratio);
+		m_layerDirty = rect();
+	}
+	if (!m_layerDirty.isEmpty()) {
+		// paint again only the invalidated part of the layer
+		QPainter p(&m_layer);
+		p.setClipRegion(m_layerDirty);
+		p.setCompositionMode(QPainter::CompositionMode_Source);
+		p.fillRect(m_layerDirty.boundingRect(), Qt::transparent);
+		p.setCompositionMode(QPainter::CompositionMode_SourceOver);
+		p.setRenderHint(QPainter::Antialiasing, true);
+		p.translate(mapFromGlobal(QPoint(0,0)));
+		paintLayer(&p);
+		m_layerDirty = QRegion();
+	}
 
 	QPainter painter(this);
-	painter.setRenderHint(QPainter::Antialiasing, true);
+	const QRegion& region = event->region();
+	for (const QRect& r : region) {
+		painter.drawPixmap(r.topLeft(), m_layer, QRectF(QPointF(r.topLeft()) * ratio, QSizeF(r.size()) * ratio));
+	}
+
+	if (m_stroking && !m_engine.curves().isEmpty()) {
+		const CalibrationEngine::Curve& c = m_engine.curves().last();
+
+		if (m_strokeLayer.size() != size) {
+			m_strokeLayer = QPixmap(size);
+			m_strokeLayer.setDevicePixelRatio(ratio);
+			m_strokeLayer.fill(Qt::transparent);
+			m_strokeDrawn = 0;
+		}
+		if (m_strokeDrawn < c.pts.size()) {
+			// only the new segments are drawn in the layer of the active curve
+			QPainter p(&m_strokeLayer);
+			p.setRenderHint(QPainter::Antialiasing, true);
+			p.translate(mapFromGlobal(QPoint(0,0)));
+			p.setPen(Qt::black);
+			const double* x = c.pts.x.constData();
+			const double* y = c.pts.y.constData();
+			for (int j = qMax(m_strokeDrawn, 1); j < c.pts.size(); ++j) p.drawLine(QLineF(x[j-1], y[j-1], x[j], y[j]));
+			m_strokeDrawn = c.pts.size();
+		}
+		for (const QRect& r : region) {
+			painter.drawPixmap(r.topLeft(), m_strokeLayer, QRectF(QPointF(r.topLeft()) * ratio, QSizeF(r.size()) * ratio));
+		}
 
-	painter.translate(mapFromGlobal(QPoint(0,0)));
+		// its fit changes with each point
+		painter.setRenderHint(QPainter::Antialiasing, true);
+		painter.translate(mapFromGlobal(QPoint(0,0)));
+		paintFit(&painter, c, m_strokeBounds);
+	}
 
-	if (m_borliMode) {
-		for (BorderLimit& elem : m_borderLimits) elem.paint(&painter, m_w, m_h);
+	QWidget::paintEvent(event);
+}
+
+void CalibrationWidget::paintLayer(QPainter* p)
+{
+	if (m_engine.fitMode()) {
+		for (int b = 0; b < 4; ++b) paintBorderLimit(p, b);
 	}
 
-	for (int i = 0; i < m_raw_points.size(); ++i) {
-		painter.setPen(Qt::black);
-		painter.drawLine(m_raw_points[i], m_phy_points[i]);
-		painter.setPen(QPen(Qt::red, 2.5));
-		painter.drawPoint(m_phy_points[i]);
-		painter.setPen(QPen(Qt::blue, 2.5));
-		painter.drawPoint(m_raw_points[i]);
+	const QVector<QPointF>& phy_points = m_engine.phyPoints();
+	const QVector<QPointF>& raw_points = m_engine.rawPoints();
+	for (int i = 0; i < raw_points.size(); ++i) {
+		p->setPen(Qt::black);
+		p->drawLine(raw_points[i], phy_points[i]);
+		p->setPen(QPen(Qt::red, 2.5));
+		p->drawPoint(phy_points[i]);
+		p->setPen(QPen(Qt::blue, 2.5));
+		p->drawPoint(raw_points[i]);
 	}
 
-	painter.setPen(Qt::red);
-	if (m_phy_points.size() > m_raw_points.size()) {
-		QPointF p = m_phy_points.last();
+	// where the area would put the control points
+	const QVector<QPointF>& residuals = m_engine.linearFit().residuals;
+	p->setPen(QPen(Qt::darkGreen, 2.5));
+	for (int i = 0; i < residuals.size(); ++i) p->drawPoint(phy_points[i] - residuals[i]);
 
-		painter.setPen(QPen(Qt::red, 2.5));
-		painter.drawPoint(p);
+	if (phy_points.size() > raw_points.size()) {
+		QPointF pt = phy_points.last();
+
+		p->setPen(QPen(Qt::red, 2.5));
+		p->drawPoint(pt);
 
 		QRectF r;
 		r.setSize(QSizeF(10, 10));
-		r.moveCenter(p);
-		painter.setPen(QPen(Qt::blue, 1.5));
-		painter.drawEllipse(r);
+		r.moveCenter(pt);
+		p->setPen(QPen(Qt::blue, 1.5));
+		p->drawEllipse(r);
 	}
 
-	for (int i = 0; i < m_curves.size(); ++i) {
-		const Curve& c = m_curves[i];
+	// the active curve is drawn over the layer
+	const QList<CalibrationEngine::Curve>& curves = m_engine.curves();
+	int finished = curves.size() - (m_stroking ? 1 : 0);
+	for (int i = 0; i < finished; ++i) {
+		const CalibrationEngine::Curve& c = curves[i];
 		if (c.pts.isEmpty()) continue;
 
+		const double* x = c.pts.x.constData();
+		const double* y = c.pts.y.constData();
 		QPainterPath path_curve;
-		path_curve.moveTo(c.pts[0]);
+		path_curve.moveTo(x[0], y[0]);
 		for (int j = 1; j < c.pts.size(); ++j) {
-			path_curve.lineTo(c.pts[j]);
-		}
-		painter.setPen(Qt::black);
-		painter.drawPath(path_curve);
-
-		if (m_borliMode && c.border != -1) {
-			painter.setPen(QPen(Qt::blue, 1.2));
-
-			double x1, y1, x2, y2;
-			if (c.border % 2 == 0) {
-				y1 = path_curve.boundingRect().top();
-				x1 = unitToPixel(c.border, c.ab[0] * y1 + c.ab[1]);
-				y2 = path_curve.boundingRect().bottom();
-				x2 = unitToPixel(c.border, c.ab[0] * y2 + c.ab[1]);
-			} else {
-				x1 = path_curve.boundingRect().left();
-				y1 = unitToPixel(c.border, c.ab[0] * x1 + c.ab[1]);
-				x2 = path_curve.boundingRect().right();
-				y2 = unitToPixel(c.border, c.ab[0] * x2 + c.ab[1]);
-			}
-			painter.drawLine(x1, y1, x2, y2);
-
-			painter.setPen(QPen(Qt::red, 1.2));
-			for (int j = 0; j < c.pts.size(); ++j) {
-				if (isInBorder(c.border, c.pts[j])) {
-					double raw = pixelToUnit(c.border, xy(c.border, c.pts[j]));
-					double phy = polynomial_evaluate(5, c.poly, raw);
-					double x, y;
-					if (c.border % 2 == 0) {
-						x = unitToPixel(c.border, phy);
-						y = c.pts[j].y();
-					} else {
-						x = c.pts[j].x();
-						y = unitToPixel(c.border, phy);
-					}
-					painter.drawPoint(x, y);
-				}
-			}
+			path_curve.lineTo(x[j], y[j]);
 		}
+		p->setPen(Qt::black);
+		p->drawPath(path_curve);
+
+		paintFit(p, c, path_curve.boundingRect());
 	}
 
 	if (m_drawRuler) {
-		painter.setRenderHint(QPainter::Antialiasing, true);
 		int dx = 10;
-		painter.translate(m_w-24*dx, 0.5*m_h);
-		painter.rotate(-20);
-		painter.setPen(QPen(Qt::black, 2));
-		painter.drawRect(-26*dx, -25, 52*dx, 50);
+		p->setTransform(rulerTransform(), true);
+		p->setPen(QPen(Qt::black, 2));
+		p->drawRect(-26*dx, -25, 52*dx, 50);
 		for (int i = 0; i <= 50; ++i) {
 			int x = -25*dx + i*dx;
 			if (i % 5 == 0) {
-				painter.setPen(QPen(Qt::black, 2));
-				painter.drawLine(x, -25, x, 10);
+				p->setPen(QPen(Qt::black, 2));
+				p->drawLine(x, -25, x, 10);
 			} else {
-				painter.setPen(QPen(Qt::black, 1));
-				painter.drawLine(x, -25, x, 0);
+				p->setPen(QPen(Qt::black, 1));
+				p->drawLine(x, -25, x, 0);
 			}
 		}
 	}
+}
 
-	QWidget::paintEvent(event);
+void CalibrationWidget::paintFit(QPainter* p, const CalibrationEngine::Curve& c, const QRectF& bounds)
+{
+	QLineF line;
+	QVector<QPointF> points;
+	if (!fitGeometry(c, bounds, line, points)) return;
+
+	p->setPen(QPen(Qt::blue, 1.2));
+	p->drawLine(line);
+	p->setPen(QPen(Qt::red, 1.2));
+	p->drawPoints(points.constData(), points.size());
+}
+
+bool CalibrationWidget::fitGeometry(const CalibrationEngine::Curve& c, const QRectF& bounds, QLineF& line, QVector<QPointF>& points) const
+{
+	if (!m_engine.fitMode() || c.border == -1) return false;
+
+	double x1, y1, x2, y2;
+	if (c.border % 2 == 0) {
+		y1 = bounds.top();
+		x1 = m_engine.unitToPixel(c.border, c.ab[0] * y1 + c.ab[1]);
+		y2 = bounds.bottom();
+		x2 = m_engine.unitToPixel(c.border, c.ab[0] * y2 + c.ab[1]);
+	} else {
+		x1 = bounds.left();
+		y1 = m_engine.unitToPixel(c.border, c.ab[0] * x1 + c.ab[1]);
+		x2 = bounds.right();
+		y2 = m_engine.unitToPixel(c.border, c.ab[0] * x2 + c.ab[1]);
+	}
+	line.setLine(x1, y1, x2, y2);
+
+	// the points in the border, corrected along x for TopX and BottomX, along y otherwise
+	const double* u = c.border % 2 == 0 ? c.pts.x.constData() : c.pts.y.constData();
+	const double* v = c.border % 2 == 0 ? c.pts.y.constData() : c.pts.x.constData();
+	const CalibrationEngine::BorderLimit& limit = m_engine.borderLimit(c.border);
+	double side = c.border < 2 ? 1.0 : -1.0;
+	points.clear();
+	for (int j = 0; j < c.pts.size(); ++j) {
+		if (side * (u[j] - limit.pos) < 0.0) {
+			double phy = m_engine.unitToPixel(c.border, polynomial_evaluate(5, c.poly, m_engine.pixelToUnit(c.border, u[j])));
+			points << (c.border % 2 == 0 ? QPointF(phy, v[j]) : QPointF(v[j], phy));
+		}
+	}
+	return true;
+}
+
+QRect CalibrationWidget::dirtyRect(const QRectF& r) const
+{
+	if (r.isNull()) return QRect();
+	QRectF w = r.translated(mapFromGlobal(QPoint(0,0)));
+	return w.adjusted(-PAINT_MARGIN, -PAINT_MARGIN, PAINT_MARGIN, PAINT_MARGIN).toAlignedRect();
+}
+
+QRectF CalibrationWidget::pointRect(const QPointF& p)
+{
+	return QRectF(p - QPointF(0.5, 0.5), QSizeF(1.0, 1.0));
+}
+
+QRectF CalibrationWidget::limitRect(int border) const
+{
+	const CalibrationEngine::BorderLimit& limit = m_engine.borderLimit(border);
+	if (limit.horizontal) return QRectF(0, limit.pos - 0.5, m_engine.width(), 1.0);
+	return QRectF(limit.pos - 0.5, 0, 1.0, m_engine.height());
+}
+
+QRectF CalibrationWidget::pointsRect() const
+{
+	const QVector<QPointF>& phy_points = m_engine.phyPoints();
+	const QVector<QPointF>& raw_points = m_engine.rawPoints();
+	QRectF r;
+	for (int i = 0; i < raw_points.size(); ++i) r |= pointRect(phy_points[i]) | pointRect(raw_points[i]);
+	const QVector<QPointF>& residuals = m_engine.linearFit().residuals;
+	for (int i = 0; i < residuals.size(); ++i) r |= pointRect(phy_points[i] - residuals[i]);
+	if (phy_points.size() > raw_points.size()) {
+		// the circle
+		r |= pointRect(phy_points.last()).adjusted(-5, -5, 5, 5);
+	}
+	return r;
+}
+
+QRectF CalibrationWidget::fitRect(const CalibrationEngine::Curve& c, const QRectF& bounds) const
+{
+	QLineF line;
+	QVector<QPointF> points;
+	if (!fitGeometry(c, bounds, line, points)) return QRectF();
+
+	QRectF r = pointRect(line.p1()) | pointRect(line.p2());
+	for (const QPointF& p : points) r |= pointRect(p);
+	return r;
+}
+
+QRegion CalibrationWidget::curvesRegion() const
+{
+	QRegion r;
+	for (const CalibrationEngine::Curve& c : m_engine.curves()) {
+		if (c.pts.isEmpty()) continue;
+		const double* x = c.pts.x.constData();
+		const double* y = c.pts.y.constData();
+		double x0 = x[0], x1 = x[0], y0 = y[0], y1 = y[0];
+		for (int j = 1; j < c.pts.size(); ++j) {
+			x0 = qMin(x0, x[j]);
+			x1 = qMax(x1, x[j]);
+			y0 = qMin(y0, y[j]);
+			y1 = qMax(y1, y[j]);
+		}
+		QRectF bounds = QRectF(QPointF(x0, y0), QPointF(x1, y1)).adjusted(-0.5, -0.5, 0.5, 0.5);
+		r += dirtyRect(bounds);
+		r += dirtyRect(fitRect(c, bounds));
+	}
+	return r;
+}
+
+QTransform CalibrationWidget::rulerTransform() const
+{
+	QTransform t;
+	t.translate(m_engine.width()-24*10, 0.5*m_engine.height());
+	t.rotate(-20);
+	return t;
+}
+
+QRectF CalibrationWidget::rulerRect() const
+{
+	return rulerTransform().mapRect(QRectF(-26*10, -25, 52*10, 50));
 }
 
 void CalibrationWidget::keyPressEvent(QKeyEvent* event)
 {
 	if (event->key() == Qt::Key_Delete) {
+		m_recorder.action(SessionEvent::Clear);
 		clearAll();
-		update();
 	}
 	if (event->key() == Qt::Key_Backspace) {
-		if (m_phy_points.size() > 0) {
-			if (m_phy_points.size() == m_raw_points.size()) {
-				m_raw_points.removeLast();
-				setCursor(QCursor(Qt::BlankCursor));
-			} else {
-				m_phy_points.removeLast();
-				setCursor(QCursor(Qt::CrossCursor));
-			}
+		m_recorder.action(SessionEvent::Undo);
+		bool points = m_engine.phyPoints().size() > 0;
+		QRegion before = curvesRegion() + dirtyRect(pointsRect());
+		if (m_stroking) before += QRegion(dirtyRect(m_strokeBounds)) + dirtyRect(m_strokeFitRect);
+		m_engine.undo();
+		m_stroking = false;
+		if (points) {
+			bool waiting = m_engine.phyPoints().size() > m_engine.rawPoints().size();
+			setCursor(QCursor(waiting ? Qt::BlankCursor : Qt::CrossCursor));
 		}
-		if (m_curves.size() > 0) m_curves.removeLast();
-		update();
+		invalidateLayer(before);
 	}
 	if (event->key() == Qt::Key_Escape) {
 		close();
@@ -354,95 +586,26 @@ void CalibrationWidget::keyPressEvent(QKeyEvent* event)
 	}
 }
 
-void CalibrationWidget::fitCurves()
+void CalibrationWidget::clearAll()
 {
-	for (int i = 0; i < m_curves.size(); ++i) {
-		Curve& c = m_curves[i];
-		if (c.pts.size() <= 3) continue;
-		int nb[4] = {0, 0, 0, 0};
-		for (int j = 0;j < c.pts.size(); ++j) {
-			if (c.pts[j].x() < m_borderLimits[TopX].pos) nb[TopX]++;
-			if (c.pts[j].y() < m_borderLimits[TopY].pos) nb[TopY]++;
-			if (c.pts[j].x() > m_borderLimits[BottomX].pos) nb[BottomX]++;
-			if (c.pts[j].y() > m_borderLimits[BottomY].pos) nb[BottomY]++;
-		}
-		c.border = -1;
-		for (int border = 0; border < 4; ++border) {
-			if (nb[border] > 0) {
-				int other;
-				for (other = border+1; other < 4; ++other) if (nb[other] > 0) break;
-				if (other == 4) c.border = border;
-				break;
-			}
-		}
-
-		if (c.border != -1) {
-			QVector<double> a, arhs;
-			for (int j = 0; j < c.pts.size(); ++j) {
-				if (!isInBorder(c.border, c.pts[j])) {
-					a << yx(c.border, c.pts[j]) << 1.0;
-					arhs << pixelToUnit(c.border, xy(c.border, c.pts[j])); // phy
-				}
-			}
-			if (arhs.isEmpty()) {
-				c.border = -1;
-			} else {
-				least_squares(arhs.size(), 2, a.data(), arhs.data(), c.ab);
-
-				a.clear();
-				arhs.clear();
-				for (int j = 0; j < c.pts.size(); ++j) {
-					if (isInBorder(c.border, c.pts[j])) {
-						double raw = pixelToUnit(c.border, xy(c.border, c.pts[j]));
-						double phy = c.ab[0]*yx(c.border, c.pts[j]) + c.ab[1];
-						a << pow(raw, 4.) << pow(raw, 3.) << pow(raw, 2.) << raw << 1.0;
-						arhs << phy;
-					}
-				}
-				double d = pixelToUnit(c.border, m_borderLimits[c.border].pos);
-				double cons[] = {
-					4.*d*d*d,      3.*d*d,      2.*d,      1.0,   0.0,
-					d*d*d*d,       d*d*d,       d*d,       d,     1.0,
-					0,             0,           0,         1.0,   0.0
-				};
-				double crhs[] = {
-					1.0,
-					d,
-					1.0
-				};
-				least_squares_constraint(arhs.size(), 5, 3, a.data(), arhs.data(), cons, crhs, c.poly);
-			}
-		}
-	}
+	m_engine.clearAll();
+	for (int& state : m_limitState) state = 0;
+	m_stroking = false;
+	m_frameSamples = 0;
+	m_frameDirty = QRegion();
+	setCursor(QCursor(Qt::CrossCursor));
+	invalidateLayer();
 }
 
-void CalibrationWidget::clearAll()
+void CalibrationWidget::invalidateLayer()
 {
-	m_borderLimits[TopX].pos = 0.1 * m_w;
-	m_borderLimits[TopX].limit = 0.4 * m_w;
-	m_borderLimits[TopX].horizontal = false;
-	m_borderLimits[TopX].state = 0;
-
-	m_borderLimits[TopY].pos = 0.1 * m_h;
-	m_borderLimits[TopY].limit = 0.4 * m_h;
-	m_borderLimits[TopY].horizontal = true;
-	m_borderLimits[TopY].state = 0;
-
-	m_borderLimits[BottomX].pos = 0.9 * m_w;
-	m_borderLimits[BottomX].limit = 0.6 * m_w;
-	m_borderLimits[BottomX].horizontal = false;
-	m_borderLimits[BottomX].state = 0;
-
-	m_borderLimits[BottomY].pos = 0.9 * m_h;
-	m_borderLimits[BottomY].limit = 0.6 * m_h;
-	m_borderLimits[BottomY].horizontal = true;
-	m_borderLimits[BottomY].state = 0;
-
-	m_phy_points.clear();
-	m_raw_points.clear();
-	setCursor(QCursor(Qt::CrossCursor));
+	invalidateLayer(rect());
+}
 
-	m_curves.clear();
+void CalibrationWidget::invalidateLayer(const QRegion& region)
+{
+	m_layerDirty += region;
+	update(region);
 }
 
 int CalibrationWidget::rotation()
@@ -455,217 +618,243 @@ int CalibrationWidget::rotation()
 	}
 }
 
-void fix_area(double slope, double offset, double range, double old_min, double old_max, int& new_min, int& new_max)
-{
-	new_min = std::round(old_min - (old_max - old_min) * offset / (slope * range));
-	new_max = std::round((old_max - old_min) / slope) + new_min;
-}
-
 void CalibrationWidget::nextStep()
 {
 	QTextStream cout(stdout);
-	QString command;
-	QProcess pro;
-
-	if (m_state == 0) {
-
-		// distortion to identity
-		command = "xinput set-float-prop \"%1\" \"Wacom Border Distortion\" 0 0 0 0 1 0   0 0 0 0 1 0   0 0 0 0 1 0   0 0 0 0 1 0";
-		command = command.arg(m_device);
-		cout << "> " << command << endl;
-		pro.start(command); pro.waitForFinished();
-		cout << pro.readAllStandardOutput();
-		cout << pro.readAllStandardError() << flush;
-
-		if (pro.exitCode() != 0) {
-			pro.start("xinput"); pro.waitForFinished();
-			if (pro.exitCode() != 0) {
-				cout << "You need to install xinput (sudo apt-get install xinput)" << endl;
-			} else {
-				QStringList devices;
-				QByteArray out = pro.readAllStandardOutput();
-				int end_pos = out.indexOf("id=");
-				while (end_pos != -1) {
-					int beg_pos = end_pos;
-					char c = out[beg_pos];
-					while (isspace(c) || isalnum(c)) c = out[--beg_pos];
-					beg_pos++;
-
-					devices << out.mid(beg_pos, end_pos-beg_pos).trimmed();
-					end_pos = out.indexOf("id=", end_pos+1);
-				}
-				bool ok;
-				QString selectedDevice = QInputDialog::getItem(this, "Select device", "Select your stylus device from the list.", devices, 0, false, &ok);
 
-				if (ok) {
-					m_device = selectedDevice;
-					nextStep();
-					return;
-				}
-			}
-		}
+	// no queue : setPropertyQueue() has not been called
+	Q_ASSERT(m_queue);
+	if (!m_queue) return;
+	// the previous step is being applied
+	if (m_queue->busy()) return;
 
-		// get area
-		command = "xinput list-props \"%1\"";
-		command = command.arg(m_device);
-		cout << "> " << command << endl;
-		pro.start(command);
-		pro.waitForFinished();
-		QByteArray output = pro.readAllStandardOutput();
-		cout << output;
-		cout << pro.readAllStandardError() << flush;
-
-		m_area.clear();
-		if (pro.exitCode() == 0) {
-			int pos = output.indexOf("Wacom Tablet Area");
-			if (pos != -1) {
-				pos = output.indexOf(':', pos);
-				pos++; // ignore the ':'
-				int end = output.indexOf('\n', pos);
-				output = output.mid(pos, end-pos);
-				QString svalues(output);
-				QStringList list = svalues.split(",", QString::SkipEmptyParts);
-				if (list.size() == 4) {
-					for (int i = 0; i < list.size(); ++i) {
-						bool ok;
-						m_area << list[i].trimmed().toInt(&ok);
-						if (!ok) {
-							m_area.clear();
-							break;
-						}
-					}
-				}
-			}
-		}
-		if (m_area.isEmpty()) {
-			cout << "Assume that Wacom Tablet Area is 0 0 10000 10000" << endl;
-			m_area << 0 << 0 << 10000 << 10000;
-		} else {
-			cout << "Wacom Tablet Area is " << m_area[0] << " " << m_area[1] << " " << m_area[2] << " " << m_area[3] << endl;
-		}
+	PropertyRequest request;
+	request.device = m_device;
 
-		m_rotation = rotation();
-		cout << "The orientation of the screen is " << m_rotation << endl;
+	if (m_engine.state() == 0) {
 
-		m_borliMode = false;
-		m_curveMode = false;
-		m_text->setText("Linear calibration : "
-										"Tap anywhere away from the borders to add a new control point");
-		m_state = 1;
-		update();
-	} else if (m_state == 1) {
-
-		QVector<int> old_area(4);
-		QVector<int> new_area(4);
-		old_area = m_area;
-		// TopX, TopY, BottomX, BottomY
-		for (int i = 0; i < m_rotation; ++i) old_area.prepend(old_area.takeLast());
-
-		QVector<double> a, arhs;
-		for (int i = 0; i < m_raw_points.size(); ++i) {
-			a << m_raw_points[i].x() << 1.0;
-			arhs << m_phy_points[i].x();
+		// distortion to identity, no table, and read the area
+		request.writes.distortion = DeviceBackend::identityDistortion();
+		request.writes.tableEntries = 0;
+		request.probe = true;
+
+		// a device already calibrated : its last area is written instead of read
+		DeviceCacheEntry cached;
+		if (m_useCache && m_cache.lookup(m_cacheKey, cached) && cached.rotation == rotation()) {
+			m_device = request.device = cached.device;
+			request.productId = cached.productId;
+			request.writes.area = cached.area;
 		}
-		double res[2];
-		int r = least_squares(arhs.size(), 2, a.data(), arhs.data(), res);
-		if (r != 0) {
+		m_queue->submit(request);
+		m_text->setText("Applying...");
+
+	} else if (m_engine.state() == 1) {
+
+		m_recorder.action(SessionEvent::Step);
+		m_deviceArea = m_engine.area();
+		if (!m_engine.nextStep()) {
 			m_text->setText("Please, add more points or quit with Escape");
-			update();
+			invalidateLayer();
 			return;
 		}
-		// phy = res[0] * raw + res[1]
-		fix_area(res[0], res[1], m_w, old_area[TopX], old_area[BottomX], new_area[TopX], new_area[BottomX]);
 
-		a.clear(); arhs.clear();
-		for (int i = 0; i < m_raw_points.size(); ++i) {
-			a << m_raw_points[i].y() << 1.0;
-			arhs << m_phy_points[i].y();
+		request.writes.area = m_engine.area();
+		m_queue->submit(request);
+
+		m_drawRuler = true;
+		m_text->setText("Applying...");
+		clearAll();
+
+	} else if (m_engine.state() == 2) {
+
+		m_recorder.action(SessionEvent::Step);
+		// the fits still in the worker are done here, as the replay does them
+		if (m_fitter.allPending()) m_engine.fitCurves();
+		else m_engine.fitStaleCurves();
+		m_engine.nextStep();
+
+		const QVector<double>& errors = m_engine.quantizationErrors();
+		for (int b = 0; b < 4; ++b) {
+			cout << "Border " << b << " : worst quantization error " << errors[b] << " (" << errors[b] * m_engine.wh(b) << " pixels)" << endl;
 		}
-		r = least_squares(arhs.size(), 2, a.data(), arhs.data(), res);
-		if (r != 0) {
-			m_text->setText("Please, add more points or quit with Escape");
-			update();
-			return;
+
+		// the polynomials and the table go together
+		request.writes.distortion = m_engine.distortion();
+		if (m_tableSize > 1) {
+			// the same correction baked for evenly spaced raw coordinates, in tablet units
+			request.writes.tableEntries = m_tableSize;
+			request.writes.table = m_engine.distortionTable(m_tableSize);
 		}
-		// phy = res[0] * raw + res[1]
-		fix_area(res[0], res[1], m_h, old_area[TopY], old_area[BottomY], new_area[TopY], new_area[BottomY]);
+		m_queue->submit(request);
 
-		// TopX, TopY, BottomX, BottomY
-		for (int i = 0; i < m_rotation; ++i) new_area.append(new_area.takeFirst());
+		m_text->setText("Applying...");
+		clearAll();
 
-		command = "xinput set-int-prop \"%1\" \"Wacom Tablet Area\" 32 %2 %3 %4 %5";
-		command = command.arg(m_device).arg(new_area[TopX]).arg(new_area[TopY]).arg(new_area[BottomX]).arg(new_area[BottomY]);
+	} else if (m_engine.state() == 3) {
+		m_recorder.close();
+		close();
+	}
+	invalidateLayer();
+}
 
-		cout << "> " << command << endl;
-		pro.start(command); pro.waitForFinished();
-		cout << pro.readAllStandardOutput();
-		cout << pro.readAllStandardError() << flush;
+void CalibrationWidget::propertiesApplied(const PropertyResult& result)
+{
+	QTextStream cout(stdout);
 
-		m_borliMode = true;
-		m_curveMode = true;
-		m_drawRuler = true;
-		m_text->setText("Distortion calibration\nWith a ruler, make a strait line");
-		m_state = 2;
-		clearAll();
-		update();
+	// the samples received meanwhile, measured with an area the device may not have
+	QVector<SessionEvent> samples;
+	samples.swap(m_pendingSamples);
 
-	} else if (m_state == 2) {
+	if (m_engine.state() == 0) {
 
-		QVector<QVector<double>> values(4);
+		bool cached = result.ok && result.matched;
+		if (m_useCache && !cached) m_cache.remove(m_cacheKey);
 
-		for (int b : {TopX, TopY, BottomX, BottomY}) {
-			values[b] << 0.0 << 0.0 << 0.0 << 0.0 << 1.0 << 0.0;
+		if (!result.ok && !result.devices.isEmpty()) {
+			bool ok;
+			QString selectedDevice = QInputDialog::getItem(this, "Select device", "Select your stylus device from the list.", result.devices, 0, false, &ok);
 
-			// take only the last curve
-			for (int j = 0; j < m_curves.size(); ++j) {
-				if (m_curves[j].border == b) {
-					values[b][0] = pixelToUnit(b, m_borderLimits[b].pos);
-					for (int i = 0; i < 5; ++ i) {
-						values[b][i + 1] = m_curves[j].poly[i];
-					}
-				}
+			if (ok) {
+				m_device = selectedDevice;
+				nextStep();
+				return;
 			}
 		}
 
-		// TopX, TopY, BottomX, BottomY
-		for (int i = 0; i < m_rotation; ++i) values.append(values.takeFirst());
-
+		QVector<int> area = result.area;
+		if (area.isEmpty()) {
+			cout << "Assume that Wacom Tablet Area is 0 0 10000 10000" << endl;
+			area << 0 << 0 << 10000 << 10000;
+		} else {
+			cout << "Wacom Tablet Area is " << area[0] << " " << area[1] << " " << area[2] << " " << area[3] << endl;
+		}
+		m_engine.setArea(area);
+
+		m_engine.setRotation(rotation());
+		cout << "The orientation of the screen is " << m_engine.rotation() << endl;
+
+		m_productId = result.productId;
+		if (cached) {
+			cout << "Known device " << m_device << endl;
+		} else if (m_useCache && result.ok && !m_productId.isEmpty()) {
+			DeviceCacheEntry entry;
+			entry.device = m_device;
+			entry.productId = m_productId;
+			entry.area = area;
+			entry.rotation = m_engine.rotation();
+			m_cache.store(m_cacheKey, entry);
+		}
 
-		command = "xinput set-float-prop \"%1\" \"Wacom Border Distortion\"";
-		command = command.arg(m_device);
-		for (int b : {TopX, TopY, BottomX, BottomY}) {
-			for (int i = 0; i < 6; ++ i) {
-				command += QString(" %1").arg(values[b][i]);
+		if (!m_recordFile.isEmpty()) {
+			SessionHeader header;
+			header.w = m_engine.width();
+			header.h = m_engine.height();
+			header.rotation = m_engine.rotation();
+			header.area = area;
+			if (m_recorder.open(m_recordFile, header)) {
+				cout << "Recording the session in " << m_recordFile << endl;
+				if (m_engine.autoLimits()) m_recorder.autoLimits(true);
+			} else {
+				cout << "Cannot record the session in " << m_recordFile << endl;
 			}
 		}
 
-		cout << "> " << command << endl;
-		pro.start(command); pro.waitForFinished();
-		cout << pro.readAllStandardOutput();
-		cout << pro.readAllStandardError() << flush;
+		m_engine.nextStep();
+		m_text->setText("Linear calibration : "
+										"Tap anywhere away from the borders to add a new control point");
 
-		m_state = 3;
-		m_borliMode = false;
-		m_text->setText("Test the result");
-		clearAll();
-		update();
+	} else if (m_engine.state() == 2) {
 
-	} else if (m_state == 3) {
-		close();
+		// the device keeps its previous area if the write failed, so does the engine
+		if (!result.ok) m_engine.setArea(m_deviceArea);
+
+		if (result.ok && m_useCache && !m_productId.isEmpty()) {
+			// the area the next calibration starts from
+			DeviceCacheEntry entry;
+			entry.device = m_device;
+			entry.productId = m_productId;
+			entry.area = m_engine.area();
+			entry.rotation = m_engine.rotation();
+			m_cache.store(m_cacheKey, entry);
+		}
+
+		if (result.ok) m_text->setText("Distortion calibration\nWith a ruler, make a strait line");
+		else m_text->setText("The tablet area could not be set, quit with Escape");
+
+	} else if (m_engine.state() == 3) {
+
+		if (result.ok) m_text->setText("Test the result");
+		else m_text->setText("The distortion could not be set, quit with Escape");
+	}
+	invalidateLayer();
+
+	// the area is the one of the device : they go to the new step, else they are dropped
+	if (result.ok) {
+		for (const SessionEvent& e : samples) tabletSample(e);
 	}
 }
 
+void CalibrationWidget::frame()
+{
+	if (m_frameSamples == 0) {
+		m_frameTimer.stop();
+		return;
+	}
+
+	// one fit and one repaint for the samples since the previous frame
+	m_fitter.submit(m_engine, false);
+	update(m_frameDirty);
+
+	m_frames++;
+	m_samples += m_frameSamples;
+	m_maxFrameSamples = qMax(m_maxFrameSamples, m_frameSamples);
+	m_frameSamples = 0;
+	m_frameDirty = QRegion();
+}
+
+void CalibrationWidget::fitsReady()
+{
+	FitJob* job = m_fitter.take();
+	if (!job) return;
+	// fitted with the automatic limits, they have been turned off since
+	if (job->engine.autoLimits() != m_engine.autoLimits()) {
+		delete job;
+		return;
+	}
+
+	if (job->all) {
+		// with the automatic limits, the limits may have moved too
+		QRegion dirty = curvesRegion();
+		for (int b = 0; b < 4; ++b) dirty += dirtyRect(limitRect(b));
+		m_engine.applyFits(job->engine, true);
+		dirty += curvesRegion();
+		for (int b = 0; b < 4; ++b) dirty += dirtyRect(limitRect(b));
+		invalidateLayer(dirty);
+	} else {
+		// the curve may have grown since, a newer request follows
+		m_engine.applyFits(job->engine, false);
+	}
+
+	if (m_stroking) {
+		QRectF fit = fitRect(m_engine.curves().last(), m_strokeBounds);
+		update(QRegion(dirtyRect(m_strokeFitRect)) + dirtyRect(fit));
+		m_strokeFitRect = fit;
+	}
+	delete job;
+}
+
 void CalibrationWidget::screenChanged()
 {
-	m_w = m_screen->size().width();
-	m_h = m_screen->size().height();
+	m_engine.setScreenSize(m_screen->size().width(), m_screen->size().height());
+	invalidateLayer();
 
-	//qDebug() << m_w << m_h << rotation() << m_screen->orientation();
+	//qDebug() << m_engine.width() << m_engine.height() << rotation() << m_screen->orientation();
 }
 
-void CalibrationWidget::BorderLimit::paint(QPainter* p, double w, double h)
+void CalibrationWidget::paintBorderLimit(QPainter* p, int border)
 {
-	switch (state) {
+	const CalibrationEngine::BorderLimit& limit = m_engine.borderLimit(border);
+	switch (m_limitState[border]) {
 		case 0:
 			p->setPen(QPen(Qt::black, 1.0));
 			break;
@@ -676,12 +865,6 @@ void CalibrationWidget::BorderLimit::paint(QPainter* p, double w, double h)
 			p->setPen(QPen(Qt::red, 1.0));
 			break;
 	}
-	if (horizontal) p->drawLine(0, pos, w, pos);
-	else p->drawLine(pos, 0, pos, h);
-}
-
-void CalibrationWidget::BorderLimit::move(double new_pos)
-{
-	if (pos < limit && new_pos < limit) pos = new_pos;
-	if (pos > limit && new_pos > limit) pos = new_pos;
+	if (limit.horizontal) p->drawLine(0, limit.pos, m_engine.width(), limit.pos);
+	else p->drawLine(limit.pos, 0, limit.pos, m_engine.height());
 }
@@ -3,32 +3,17 @@
 
 #include <QWidget>
 #include <QLabel>
-
-/*         Top Y
-*    +--------------+
-* Top|              |
-*  X |              | Bottom X
-*    |              |
-*    +--------------+
-*        Bottom Y
-*
-*
-*
-*     +-----------------------------+
-*     |                      |      |
-*     |                      |      |
-*     |                      |      |
-*     |                      |      |<-- Screen border
-*     |                      |      |
-*     |                      |      |
-*     |    Axis of Unit      |      |
-* <---1----------------------|------0
-*     |                      |      |
-*     +-----------------------------+
-*                            ^
-*                BorderLimit |
-*
-*/
+#include <QPixmap>
+#include <QRegion>
+#include <QTransform>
+#include <QLineF>
+#include <QTimer>
+
+#include "calibrationengine.hh"
+#include "session.hh"
+#include "propertyqueue.hh"
+#include "devicecache.hh"
+#include "fitworker.hh"
 
 class CalibrationWidget : public QWidget
 {
@@ -37,14 +22,19 @@ public:
 	explicit CalibrationWidget(const QString& dev, QWidget *parent = 0);
 	~CalibrationWidget();
 
-	enum Border {
-		TopX = 0,
-		TopY = 1,
-		BottomX = 2,
-		BottomY = 3
-	};
-
-	inline void setDevice(const QString& dev) { m_device = dev; }
+	inline void setDevice(const QString& dev) { m_device = m_cacheKey = dev; }
+	// must be set before nextStep(), not owned
+	void setPropertyQueue(PropertyQueue* queue);
+	// 0 to upload only the polynomials
+	inline void setDistortionTableSize(int entries) { m_tableSize = entries; }
+	// see CalibrationEngine::setResampleSpacing
+	inline void setResampleSpacing(double spacing) { m_engine.setResampleSpacing(spacing); }
+	// see CalibrationEngine::setAutoLimits, off when a limit is grabbed
+	inline void setAutoLimits(bool enabled) { m_engine.setAutoLimits(enabled); }
+	// record the session from the linear calibration, see session.hh
+	inline void setRecordFile(const QString& path) { m_recordFile = path; }
+	// start from what the previous calibration of the device left, see devicecache.hh
+	inline void setDeviceCacheEnabled(bool enabled) { m_useCache = enabled; }
 
 private:
 	virtual void mousePressEvent(QMouseEvent* event) override;
@@ -55,75 +45,91 @@ private:
 	virtual void keyPressEvent(QKeyEvent* event) override;
 
 
-	void fitCurves();
+	// a tablet event, the pen or the eraser
+	void tabletSample(const SessionEvent& e);
+
 	void clearAll();
 	int rotation();
+	// the border limits, the control points or the finished curves changed
+	void invalidateLayer();
+	void invalidateLayer(const QRegion& region);
 
 public slots:
 	void nextStep();
 
 private slots:
 	void screenChanged();
+	void propertiesApplied(const PropertyResult& result);
+	// fit and paint the samples received since the previous frame
+	void frame();
+	// take the fits of the worker
+	void fitsReady();
 
 private:
-	inline double wh(int border) const {
-		return border % 2 == 0 ? m_w : m_h;
-	}
-	inline double xy(int border, const QPointF& point) const {
-		return border % 2 == 0 ? point.x() : point.y();
-	}
-	inline double yx(int border, const QPointF& point) const {
-		return border % 2 == 0 ? point.y() : point.x();
-	}
-	bool isInBorder(int border, const QPointF& point) const {
-		return (border < 2) ? xy(border, point) < m_borderLimits[border].pos
-												: xy(border, point) > m_borderLimits[border].pos;
-	}
-	double pixelToUnit(int border, double pixel) const {
-		return (border < 2) ? pixel / wh(border)
-												: 1.0 - pixel / wh(border);
-	}
-	double unitToPixel(int border, double unit) const {
-		return (border < 2) ? unit * wh(border)
-												: (1.0 - unit) * wh(border);
-	}
-
-	bool m_curveMode;
-	bool m_borliMode;
-	bool m_drawRuler;
-
-	QScreen* m_screen;
-	double m_w, m_h;
-	int m_rotation;
+	void paintBorderLimit(QPainter* p, int border);
+	// all but the active curve
+	void paintLayer(QPainter* p);
+	// line and corrected points, bounds : of the points of the curve
+	void paintFit(QPainter* p, const CalibrationEngine::Curve& c, const QRectF& bounds);
+	// false if the curve is not fitted
+	bool fitGeometry(const CalibrationEngine::Curve& c, const QRectF& bounds, QLineF& line, QVector<QPointF>& points) const;
+
+	/* what is painted, in global coordinates, for the invalidated regions
+	 * dirtyRect gives the widget rect with the pen width around
+	 */
+	QRect dirtyRect(const QRectF& r) const;
+	static QRectF pointRect(const QPointF& p);
+	QRectF limitRect(int border) const;
+	QRectF pointsRect() const;
+	QRectF fitRect(const CalibrationEngine::Curve& c, const QRectF& bounds) const;
+	// widget region of all the curves
+	QRegion curvesRegion() const;
+	QTransform rulerTransform() const;
+	QRectF rulerRect() const;
 
-	QVector<QPointF> m_phy_points;
-	QVector<QPointF> m_raw_points;
-	QLabel* m_text;
+	bool m_drawRuler;
 
-	struct BorderLimit {
-		double pos;
-		double limit;
-		bool horizontal;
-		int state;
+	// what does not change while a curve is drawn, painted again where invalidated
+	QPixmap m_layer;
+	QRegion m_layerDirty;
+	// the segments of the active curve, drawn as they come
+	QPixmap m_strokeLayer;
+	int m_strokeDrawn; // points of the active curve in m_strokeLayer
+	QRectF m_strokeBounds;
+	QRectF m_strokeFitRect; // of its fit, as last painted
+	bool m_stroking; // the last curve is being drawn
+
+	// the samples of the active curve are coalesced, one fit and one repaint per display frame
+	QTimer m_frameTimer;
+	int m_frameSamples; // since the previous frame
+	QRegion m_frameDirty; // their segments
+	qint64 m_frames;
+	qint64 m_samples;
+	int m_maxFrameSamples;
+
+	// the fits run in another thread
+	FitWorker m_fitter;
 
-		void paint(QPainter* p, double w, double h);
-		void move(double new_pos);
-	} m_borderLimits[4];
+	QScreen* m_screen;
 
-	struct Curve {
-		QList<QPointF> pts;
-		int border;
+	CalibrationEngine m_engine;
+	int m_limitState[4]; // 0 : idle, 1 : under the mouse, 2 : grabbed
 
-		// comments holds for TopX border
-		double ab[2]; // phy_x = a*y + b; y in pixels, phy_x [0,1] unit
-		double poly[5]; // order 4 polynomial phy_x = Poly(raw_x)
-	};
+	QLabel* m_text;
 
-	QList<Curve> m_curves;
+	SessionRecorder m_recorder;
+	QString m_recordFile;
 
-	QVector<int> m_area;
+	PropertyQueue* m_queue;
+	QVector<SessionEvent> m_pendingSamples; // received while a step is applied
 	QString m_device;
-	int m_state;
+	QVector<int> m_deviceArea; // the area of the device while the linear calibration is applied
+	int m_tableSize;
+
+	DeviceCache m_cache;
+	QString m_cacheKey; // the device given on the command line
+	bool m_useCache;
+	QVector<int> m_productId;
 };
 
 #endif // CALIBRATIONWIDGET_H
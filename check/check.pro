@@ -0,0 +1,20 @@
+#-------------------------------------------------
+#
+# Check of the lmath.hh templates against lmath.c
+#
+#-------------------------------------------------
+
+CONFIG   -= qt app_bundle
+CONFIG   += console c++11 testcase
+
+TARGET = lmath-check
+TEMPLATE = app
+
+LIBS += -lm
+
+SOURCES += lmath-check.cc \
+    ../lmath.c
+
+HEADERS  += \
+    ../lmath.h \
+    ../lmath.hh
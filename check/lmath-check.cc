@@ -0,0 +1,335 @@
+/* Check the compile-time sized solvers of lmath.hh against lmath.c
+ *
+ * Random systems of three kinds are solved by both :
+ *   dominant : diagonally dominant, the LU needs no row swap
+ *   random   : uniform entries, the LU swaps rows (partial pivoting)
+ *   singular : one row (or column) repeats another, the solvers must fail
+ * The templates do the operations of lmath.c in the same order, so their
+ * solutions, factorizations and return codes must be bitwise identical.
+ * The batched solvers do not keep that order, they are checked system by
+ * system within a relative tolerance, with the return codes.
+ *
+ * usage : lmath-check [systems per shape]
+ * the exit status is the number of shapes that failed
+ */
+#include "../lmath.hh"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <vector>
+
+static const double TOLERANCE = 1e-10;
+
+static double uniform()
+{
+	return 2.0 * rand() / RAND_MAX - 1.0;
+}
+
+enum Kind { Dominant, Random, Singular };
+static const char* kinds[] = { "dominant", "random", "singular" };
+
+/* n x n
+ * Dominant : the diagonal dominates its row
+ * Singular : the last row is a copy of the first, the elimination makes it exactly 0
+ */
+static void make_square(int n, double* A, Kind kind)
+{
+	for (int i = 0; i < n*n; ++i) A[i] = uniform();
+	if (kind == Dominant) {
+		for (int i = 0; i < n; ++i) {
+			double s = 0.0;
+			for (int j = 0; j < n; ++j) s += fabs(A[i*n+j]);
+			A[i*n+i] = (A[i*n+i] < 0.0 ? -1.0 : 1.0) * (s + 1.0);
+		}
+	}
+	if (kind == Singular) {
+		for (int j = 0; j < n; ++j) A[(n-1)*n+j] = A[j];
+	}
+}
+
+/* n x m, Singular : the last column is a copy of the first, A^t A is singular */
+static void make_tall(int n, int m, double* A, Kind kind)
+{
+	for (int i = 0; i < n*m; ++i) A[i] = uniform();
+	if (kind == Singular) {
+		for (int i = 0; i < n; ++i) A[i*m+m-1] = A[i*m];
+	}
+}
+
+static void make_vector(int n, double* b)
+{
+	for (int i = 0; i < n; ++i) b[i] = uniform();
+}
+
+// worst |x - ref| / (1 + |ref|)
+static double difference(int n, const double* x, const double* ref)
+{
+	double d = 0.0;
+	for (int i = 0; i < n; ++i) d = fmax(d, fabs(x[i] - ref[i]) / (1.0 + fabs(ref[i])));
+	return d;
+}
+
+static bool same(int n, const double* x, const double* ref)
+{
+	return memcmp(x, ref, n * sizeof(double)) == 0;
+}
+
+static int report(const char* name, Kind kind, double worst, int failures)
+{
+	printf("%-46s %-9s %12.3e %s\n", name, kinds[kind], worst, failures ? "FAILED" : "ok");
+	return failures ? 1 : 0;
+}
+
+template<int N>
+static int check_solve_ls(int count, Kind kind)
+{
+	double A[N*N], b[N], x[N], ref[N];
+	double worst = 0.0;
+	int failures = 0;
+
+	for (int t = 0; t < count; ++t) {
+		make_square(N, A, kind);
+		make_vector(N, b);
+		int r = lmath::solve_ls<N>(A, b, x);
+		int rref = solve_ls(N, A, b, ref);
+		worst = fmax(worst, difference(N, x, ref));
+		if (r != rref || (kind == Singular) != (r != 0) || !same(N, x, ref)) failures++;
+	}
+
+	char name[64];
+	snprintf(name, sizeof name, "solve_ls<%d>", N);
+	return report(name, kind, worst, failures);
+}
+
+template<int N, int K>
+static int check_lu_solve_many(int count, Kind kind)
+{
+	double A[N*N], B[N*K], X[N*K], ref[N*K];
+	double LU[N*N], LUref[N*N];
+	int piv[N], pivref[N];
+	double worst = 0.0;
+	int failures = 0;
+
+	for (int t = 0; t < count; ++t) {
+		make_square(N, A, kind);
+		make_vector(N*K, B);
+
+		for (int i = 0; i < N*N; ++i) LU[i] = A[i];
+		int r = lmath::lu_factor<N>(LU, piv);
+		r |= lmath::lu_solve_many<N, K>(LU, piv, B, X);
+
+		lu_factorization lu;
+		lu.LU = LUref;
+		lu.piv = pivref;
+		int rref = lu_factor(&lu, N, A);
+		rref |= lu_solve_many(&lu, K, B, ref);
+
+		worst = fmax(worst, difference(N*K, X, ref));
+		if (r != rref || (kind == Singular) != (r != 0) || !same(N*K, X, ref) || !same(N*N, LU, LUref) ||
+			 memcmp(piv, pivref, sizeof piv) != 0) failures++;
+	}
+
+	char name[64];
+	snprintf(name, sizeof name, "lu_factor<%d>, lu_solve_many<%d, %d>", N, N, K);
+	return report(name, kind, worst, failures);
+}
+
+template<int M>
+static int check_least_squares(int count, int n, Kind kind)
+{
+	std::vector<double> A(n*M), b(n);
+	double x[M], ref[M];
+	double worst = 0.0;
+	int failures = 0;
+
+	for (int t = 0; t < count; ++t) {
+		make_tall(n, M, A.data(), kind);
+		make_vector(n, b.data());
+		int r = lmath::least_squares<M>(n, A.data(), b.data(), x);
+		int rref = least_squares(n, M, A.data(), b.data(), ref);
+		worst = fmax(worst, difference(M, x, ref));
+		if (r != rref || (kind == Singular) != (r != 0) || !same(M, x, ref)) failures++;
+	}
+
+	char name[64];
+	snprintf(name, sizeof name, "least_squares<%d>", M);
+	return report(name, kind, worst, failures);
+}
+
+template<int M, int P>
+static int check_least_squares_constraint(int count, int n, Kind kind)
+{
+	std::vector<double> A(n*M), b(n);
+	double C[P*M], e[P];
+	double x[M], ref[M];
+	double worst = 0.0;
+	int failures = 0;
+
+	for (int t = 0; t < count; ++t) {
+		make_tall(n, M, A.data(), kind);
+		make_vector(n, b.data());
+		// independent constraints : the first P columns of C dominate
+		make_vector(P*M, C);
+		for (int i = 0; i < P; ++i) C[i*M+i] += 2.0 * M;
+		make_vector(P, e);
+		int r = lmath::least_squares_constraint<M, P>(n, A.data(), b.data(), C, e, x);
+		int rref = least_squares_constraint(n, M, P, A.data(), b.data(), C, e, ref);
+		// a singular A^t A can be made regular by the constraints, only the agreement is checked
+		worst = fmax(worst, difference(M, x, ref));
+		if (r != rref || !same(M, x, ref)) failures++;
+	}
+
+	char name[64];
+	snprintf(name, sizeof name, "least_squares_constraint<%d, %d>", M, P);
+	return report(name, kind, worst, failures);
+}
+
+template<int M, int P>
+static int check_accumulator(int count, int n)
+{
+	double a[M], C[P*M], e[P];
+	double x[M], ref[M];
+	double worst = 0.0;
+	int failures = 0;
+
+	for (int t = 0; t < count; ++t) {
+		ls_accumulator acc;
+		ls_accumulator_init(&acc, M);
+		for (int k = 0; k < n; ++k) {
+			make_vector(M, a);
+			ls_accumulator_add_row(&acc, a, uniform());
+		}
+		make_vector(P*M, C);
+		for (int i = 0; i < P; ++i) C[i*M+i] += 2.0 * M;
+		make_vector(P, e);
+
+		int r = lmath::solve<M>(acc, x);
+		int rref = ls_accumulator_solve(&acc, ref);
+		worst = fmax(worst, difference(M, x, ref));
+		if (r != rref || !same(M, x, ref)) failures++;
+
+		r = lmath::solve_constraint<M, P>(acc, C, e, x);
+		rref = ls_accumulator_solve_constraint(&acc, P, C, e, ref);
+		worst = fmax(worst, difference(M, x, ref));
+		if (r != rref || !same(M, x, ref)) failures++;
+	}
+
+	char name[64];
+	snprintf(name, sizeof name, "solve<%d>, solve_constraint<%d, %d>", M, M, P);
+	return report(name, Random, worst, failures);
+}
+
+// the batch is checked against the C solver of each system
+template<int N>
+static int check_solve_ls_batch(int count, Kind kind)
+{
+	std::vector<double> A(N*N*count), b(N*count), x(N*count);
+	std::vector<double> work(lmath::solve_ls_batch_workspace<N>(count));
+	double As[N*N], bs[N], ref[N], xs[N];
+	double worst = 0.0;
+	int failures = 0;
+
+	// with Singular one system in two is singular
+	for (int s = 0; s < count; ++s) {
+		make_square(N, As, kind == Singular && s % 2 == 0 ? Random : kind);
+		make_vector(N, bs);
+		for (int i = 0; i < N*N; ++i) A[i*count+s] = As[i];
+		for (int i = 0; i < N; ++i) b[i*count+s] = bs[i];
+	}
+	int r = lmath::solve_ls_batch<N>(count, A.data(), b.data(), x.data(), work.data());
+	int rref = 0;
+
+	for (int s = 0; s < count; ++s) {
+		for (int i = 0; i < N*N; ++i) As[i] = A[i*count+s];
+		for (int i = 0; i < N; ++i) bs[i] = b[i*count+s];
+		for (int i = 0; i < N; ++i) xs[i] = x[i*count+s];
+		rref |= solve_ls(N, As, bs, ref);
+		double d = difference(N, xs, ref);
+		worst = fmax(worst, d);
+		if (!(d <= TOLERANCE)) failures++;
+	}
+	if (r != rref || (kind == Singular) != (r != 0)) failures++;
+
+	char name[64];
+	snprintf(name, sizeof name, "solve_ls_batch<%d>", N);
+	return report(name, kind, worst, failures);
+}
+
+template<int M, int P>
+static int check_least_squares_constraint_normal_batch(int count, int n)
+{
+	std::vector<double> ATA(M*M*count), ATb(M*count), C(P*M*count), e(P*count), x(M*count);
+	std::vector<double> work(lmath::least_squares_constraint_normal_batch_workspace<M, P>(count));
+	std::vector<ls_accumulator> acc(count);
+	double a[M], Cs[P*M], es[P], ref[M], xs[M];
+	double worst = 0.0;
+	int failures = 0;
+
+	for (int s = 0; s < count; ++s) {
+		ls_accumulator_init(&acc[s], M);
+		for (int k = 0; k < n; ++k) {
+			make_vector(M, a);
+			ls_accumulator_add_row(&acc[s], a, uniform());
+		}
+		make_vector(P*M, Cs);
+		for (int i = 0; i < P; ++i) Cs[i*M+i] += 2.0 * M;
+		make_vector(P, es);
+
+		for (int i = 0; i < M*M; ++i) ATA[i*count+s] = acc[s].ATA[i];
+		for (int i = 0; i < M; ++i) ATb[i*count+s] = acc[s].ATb[i];
+		for (int i = 0; i < P*M; ++i) C[i*count+s] = Cs[i];
+		for (int i = 0; i < P; ++i) e[i*count+s] = es[i];
+	}
+	int r = lmath::least_squares_constraint_normal_batch<M, P>(count, ATA.data(), ATb.data(),
+																				  C.data(), e.data(), x.data(), work.data());
+	if (r != 0) failures++;
+
+	for (int s = 0; s < count; ++s) {
+		for (int i = 0; i < P*M; ++i) Cs[i] = C[i*count+s];
+		for (int i = 0; i < P; ++i) es[i] = e[i*count+s];
+		for (int i = 0; i < M; ++i) xs[i] = x[i*count+s];
+		least_squares_constraint_normal(M, P, acc[s].ATA, acc[s].ATb, Cs, es, ref);
+		double d = difference(M, xs, ref);
+		worst = fmax(worst, d);
+		if (!(d <= TOLERANCE)) failures++;
+	}
+
+	char name[64];
+	snprintf(name, sizeof name, "least_squares_constraint_normal_batch<%d, %d>", M, P);
+	return report(name, Random, worst, failures);
+}
+
+int main(int argc, char *argv[])
+{
+	int count = argc > 1 ? atoi(argv[1]) : 1000;
+	int failed = 0;
+
+	srand(1);
+	printf("%-46s %-9s %12s\n", "solver", "systems", "worst diff");
+
+	// the shapes of the calibration : lines (2), affine (3), quartics (5) with 3 constraints
+	for (int k = Dominant; k <= Singular; ++k) {
+		Kind kind = Kind(k);
+		failed += check_solve_ls<2>(count, kind);
+		failed += check_solve_ls<3>(count, kind);
+		failed += check_solve_ls<5>(count, kind);
+		failed += check_solve_ls<8>(count, kind);
+		failed += check_lu_solve_many<5, 3>(count, kind);
+		failed += check_solve_ls_batch<2>(count, kind);
+		failed += check_solve_ls_batch<8>(count, kind);
+	}
+	for (int k = Random; k <= Singular; ++k) {
+		Kind kind = Kind(k);
+		failed += check_least_squares<2>(count, 50, kind);
+		failed += check_least_squares<5>(count, 50, kind);
+		failed += check_least_squares_constraint<5, 3>(count, 50, kind);
+		failed += check_least_squares_constraint<2, 1>(count, 50, kind);
+	}
+	failed += check_accumulator<2, 1>(count, 50);
+	failed += check_accumulator<3, 1>(count, 50);
+	failed += check_accumulator<5, 3>(count, 50);
+	failed += check_least_squares_constraint_normal_batch<5, 3>(count, 50);
+
+	return failed;
+}
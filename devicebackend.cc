@@ -0,0 +1,114 @@
+#include "devicebackend.hh"
+#include "properties.hh"
+#include <QProcess>
+#include <QTextStream>
+
+#ifdef HAVE_XI
+#include "xibackend.hh"
+#include <QX11Info>
+#endif
+
+QVector<double> DeviceBackend::identityDistortion()
+{
+	QVector<double> identity;
+	for (int b = 0; b < 4; ++b) identity << 0.0 << 0.0 << 0.0 << 0.0 << 1.0 << 0.0;
+	return identity;
+}
+
+bool DeviceBackend::write(const QString& device, const PropertyWrites& writes)
+{
+	bool ok = true;
+	if (!writes.distortion.isEmpty()) ok = setDistortion(device, writes.distortion) && ok;
+	if (writes.tableEntries >= 0) ok = setDistortionTable(device, writes.tableEntries, writes.table) && ok;
+	if (!writes.area.isEmpty()) ok = setArea(device, writes.area) && ok;
+	return ok;
+}
+
+DeviceBackend* DeviceBackend::create(bool native, bool shareDisplay)
+{
+#ifdef HAVE_XI
+	if (native) {
+		// share the connection of the GUI, open one in batch mode or for another thread
+		bool share = shareDisplay && QX11Info::isPlatformX11();
+		XiBackend* xi = new XiBackend(share ? QX11Info::display() : 0);
+		if (xi->isValid()) return xi;
+		delete xi;
+	}
+#else
+	Q_UNUSED(native);
+	Q_UNUSED(shareDisplay);
+#endif
+	return new XinputBackend();
+}
+
+QStringList XinputBackend::devices()
+{
+	QTextStream cout(stdout);
+	QStringList devices;
+
+	QProcess pro;
+	pro.start("xinput"); pro.waitForFinished(COMMAND_TIMEOUT);
+	if (pro.exitCode() != 0 || pro.error() == QProcess::FailedToStart) {
+		cout << "You need to install xinput (sudo apt-get install xinput)" << endl;
+		return devices;
+	}
+
+	QByteArray out = pro.readAllStandardOutput();
+	int end_pos = out.indexOf("id=");
+	while (end_pos != -1) {
+		int beg_pos = end_pos;
+		char c = out[beg_pos];
+		while (isspace(c) || isalnum(c)) c = out[--beg_pos];
+		beg_pos++;
+
+		devices << out.mid(beg_pos, end_pos-beg_pos).trimmed();
+		end_pos = out.indexOf("id=", end_pos+1);
+	}
+	return devices;
+}
+
+QVector<int> XinputBackend::area(const QString& device)
+{
+	QTextStream cout(stdout);
+	QByteArray output;
+	if (runCommand(listPropertiesCommand(device), cout, &output) != 0) return QVector<int>();
+	return parseArea(output);
+}
+
+bool XinputBackend::setArea(const QString& device, const QVector<int>& area)
+{
+	QTextStream cout(stdout);
+	return runCommand(areaCommand(device, area), cout) == 0;
+}
+
+QVector<int> XinputBackend::productId(const QString& device)
+{
+	QTextStream cout(stdout);
+	QByteArray output;
+	if (runCommand(listPropertiesCommand(device), cout, &output) != 0) return QVector<int>();
+	return parseProductId(output);
+}
+
+bool XinputBackend::setDistortion(const QString& device, const QVector<double>& distortion)
+{
+	QTextStream cout(stdout);
+	return runCommand(distortionCommand(device, distortion), cout) == 0;
+}
+
+bool XinputBackend::setDistortionTable(const QString& device, int entries, const QVector<int>& table)
+{
+	QTextStream cout(stdout);
+	if (entries == 0) return runCommand(resetDistortionTableCommand(device), cout) == 0;
+	return runCommand(distortionTableCommand(device, entries, table), cout) == 0;
+}
+
+bool XinputBackend::write(const QString& device, const PropertyWrites& writes)
+{
+	QTextStream cout(stdout);
+	QStringList commands;
+	if (!writes.distortion.isEmpty()) commands << distortionCommand(device, writes.distortion);
+	if (writes.tableEntries == 0) commands << resetDistortionTableCommand(device);
+	if (writes.tableEntries > 0) commands << distortionTableCommand(device, writes.tableEntries, writes.table);
+	if (!writes.area.isEmpty()) commands << areaCommand(device, writes.area);
+	return runCommands(commands, cout) == 0;
+}
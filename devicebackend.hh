@@ -0,0 +1,75 @@
+#ifndef DEVICEBACKEND_H
+#define DEVICEBACKEND_H
+
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+/* The properties written at one step, the empty ones are left unchanged */
+struct PropertyWrites {
+	PropertyWrites() : tableEntries(-1) {}
+
+	QVector<double> distortion;
+	int tableEntries; // -1 : unchanged, 0 : disabled
+	QVector<int> table;
+	QVector<int> area;
+};
+
+/* Access to the properties of the patched driver
+ * XinputBackend runs the xinput program, XiBackend (HAVE_XI) talks to the
+ * X server with libXi and writes the values in binary
+ * the devices are given by name or by id
+ */
+class DeviceBackend
+{
+public:
+	virtual ~DeviceBackend() {}
+
+	virtual QString name() const = 0;
+
+	// names of the input devices, empty if they can not be listed
+	virtual QStringList devices() = 0;
+
+	// "Wacom Tablet Area" : TopX, TopY, BottomX, BottomY, empty if not found
+	virtual QVector<int> area(const QString& device) = 0;
+	virtual bool setArea(const QString& device, const QVector<int>& area) = 0;
+
+	// "Device Product ID" : vendor, product, empty if not found
+	virtual QVector<int> productId(const QString& device) = 0;
+
+	// "Wacom Border Distortion" : 4x[border width, x^4, x^3, x^2, x, 1]
+	virtual bool setDistortion(const QString& device, const QVector<double>& distortion) = 0;
+
+	// "Wacom Border Distortion Table" : entries per axis, 0 disables the table
+	virtual bool setDistortionTable(const QString& device, int entries, const QVector<int>& table) = 0;
+
+	// identity polynomials
+	static QVector<double> identityDistortion();
+
+	/* all the writes of a step, sent back-to-back
+	 * return false if one of them failed
+	 */
+	virtual bool write(const QString& device, const PropertyWrites& writes);
+
+	/* XiBackend if native and if the X server can be reached, XinputBackend otherwise
+	 * shareDisplay : use the connection of the GUI, only from the GUI thread
+	 * the caller owns the result
+	 */
+	static DeviceBackend* create(bool native, bool shareDisplay = true);
+};
+
+class XinputBackend : public DeviceBackend
+{
+public:
+	virtual QString name() const override { return "xinput"; }
+	virtual QStringList devices() override;
+	virtual QVector<int> area(const QString& device) override;
+	virtual bool setArea(const QString& device, const QVector<int>& area) override;
+	virtual QVector<int> productId(const QString& device) override;
+	virtual bool setDistortion(const QString& device, const QVector<double>& distortion) override;
+	virtual bool setDistortionTable(const QString& device, int entries, const QVector<int>& table) override;
+	// one xinput process per property, all running at the same time
+	virtual bool write(const QString& device, const PropertyWrites& writes) override;
+};
+
+#endif // DEVICEBACKEND_H
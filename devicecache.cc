@@ -0,0 +1,62 @@
+#include "devicecache.hh"
+#include <QStringList>
+
+// '/' and '\' are separators for QSettings
+static QString group(const QString& key)
+{
+	return "devices/" + QString::fromLatin1(key.toUtf8().toPercentEncoding());
+}
+
+static QString join(const QVector<int>& values)
+{
+	QStringList list;
+	for (int v : values) list << QString::number(v);
+	return list.join(' ');
+}
+
+// empty if there are not count integers
+static QVector<int> split(const QString& s, int count)
+{
+	QVector<int> values;
+	QStringList list = s.split(' ', QString::SkipEmptyParts);
+	if (list.size() != count) return values;
+	for (int i = 0; i < count; ++i) {
+		bool ok;
+		values << list[i].toInt(&ok);
+		if (!ok) return QVector<int>();
+	}
+	return values;
+}
+
+DeviceCache::DeviceCache() : m_settings("wacom-distortion", "devices")
+{
+
+}
+
+bool DeviceCache::lookup(const QString& key, DeviceCacheEntry& entry)
+{
+	m_settings.beginGroup(group(key));
+	entry.device = m_settings.value("device").toString();
+	entry.productId = split(m_settings.value("product").toString(), 2);
+	entry.area = split(m_settings.value("area").toString(), 4);
+	entry.rotation = m_settings.value("rotation", -1).toInt();
+	m_settings.endGroup();
+
+	return !entry.device.isEmpty() && !entry.productId.isEmpty() && !entry.area.isEmpty() &&
+			 entry.rotation >= 0 && entry.rotation < 4;
+}
+
+void DeviceCache::store(const QString& key, const DeviceCacheEntry& entry)
+{
+	m_settings.beginGroup(group(key));
+	m_settings.setValue("device", entry.device);
+	m_settings.setValue("product", join(entry.productId));
+	m_settings.setValue("area", join(entry.area));
+	m_settings.setValue("rotation", entry.rotation);
+	m_settings.endGroup();
+}
+
+void DeviceCache::remove(const QString& key)
+{
+	m_settings.remove(group(key));
+}
@@ -0,0 +1,33 @@
+#ifndef DEVICECACHE_H
+#define DEVICECACHE_H
+
+#include <QString>
+#include <QVector>
+#include <QSettings>
+
+/* What the last calibration learned about a device, so that the next one
+ * starts without listing the devices nor reading the area
+ * the entries are keyed by the device given on the command line (name or id)
+ */
+struct DeviceCacheEntry {
+	QString device;         // the device that has been used (may have been selected in the list)
+	QVector<int> productId; // vendor, product : checked before the entry is used
+	QVector<int> area;      // last area written by the calibration, or read from the device
+	int rotation;           // orientation of the screen, see CalibrationEngine::setRotation
+};
+
+class DeviceCache
+{
+public:
+	DeviceCache();
+
+	// false if there is no valid entry for key
+	bool lookup(const QString& key, DeviceCacheEntry& entry);
+	void store(const QString& key, const DeviceCacheEntry& entry);
+	void remove(const QString& key);
+
+private:
+	QSettings m_settings;
+};
+
+#endif // DEVICECACHE_H
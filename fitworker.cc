@@ -0,0 +1,69 @@
+#include "fitworker.hh"
+
+void FitRunner::process()
+{
+	// the requests submitted meanwhile replace each other
+	while (FitJob* job = m_worker->m_job.fetchAndStoreOrdered(0)) {
+		double limits[4];
+		for (int b = 0; b < 4; ++b) limits[b] = job->engine.borderLimit(b).pos;
+
+		if (job->all) job->engine.fitCurves();
+		else job->engine.fitActiveCurve();
+
+		// the automatic limits moved, the curves of their borders have been fitted again
+		for (int b = 0; b < 4; ++b) {
+			if (job->engine.borderLimit(b).pos != limits[b]) job->all = true;
+		}
+
+		if (FitJob* old = m_worker->m_result.fetchAndStoreOrdered(job)) {
+			m_worker->m_superseded.ref();
+			delete old;
+		}
+		emit m_worker->ready();
+	}
+}
+
+FitWorker::FitWorker(QObject* parent) : QObject(parent)
+{
+	m_submitted = 0;
+	m_allPending = 0;
+
+	FitRunner* runner = new FitRunner(this);
+	runner->moveToThread(&m_thread);
+	connect(&m_thread, &QThread::finished, runner, &QObject::deleteLater);
+	connect(this, &FitWorker::wake, runner, &FitRunner::process);
+	m_thread.start();
+}
+
+FitWorker::~FitWorker()
+{
+	m_thread.quit();
+	m_thread.wait();
+	delete m_job.fetchAndStoreOrdered(0);
+	delete m_result.fetchAndStoreOrdered(0);
+}
+
+void FitWorker::submit(const CalibrationEngine& engine, bool all)
+{
+	FitJob* job = new FitJob;
+	job->engine = engine;
+	job->generation = ++m_submitted;
+	// a request can replace the one for all the curves, it takes its place
+	if (all) m_allPending = job->generation;
+	job->all = m_allPending > 0;
+
+	if (FitJob* old = m_job.fetchAndStoreOrdered(job)) {
+		// not started : replaced, the runner has already been woken up
+		m_superseded.ref();
+		delete old;
+	} else {
+		emit wake();
+	}
+}
+
+FitJob* FitWorker::take()
+{
+	FitJob* job = m_result.fetchAndStoreOrdered(0);
+	if (job && job->all && job->generation >= m_allPending) m_allPending = 0;
+	return job;
+}
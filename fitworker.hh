@@ -0,0 +1,83 @@
+#ifndef FITWORKER_H
+#define FITWORKER_H
+
+#include <QObject>
+#include <QThread>
+#include <QAtomicPointer>
+#include <QAtomicInt>
+
+#include "calibrationengine.hh"
+
+/* A copy of the engine to fit, then fitted */
+struct FitJob {
+	CalibrationEngine engine;
+	bool all; // all the curves, else only the active one
+	int generation; // number of the request
+};
+
+class FitWorker;
+
+// lives in the thread of FitWorker
+class FitRunner : public QObject
+{
+	Q_OBJECT
+public:
+	explicit FitRunner(FitWorker* worker) : m_worker(worker) {}
+
+public slots:
+	void process();
+
+private:
+	FitWorker* m_worker;
+};
+
+/* Fits the curves in another thread, so that the fits never delay the input
+ * nor the painting
+ * the engine is copied when a fit is submitted, the copy shares the points, the
+ * sums and the indexes of the curves with the engine (implicit sharing) but not
+ * its storage of the fits : the job copies the data it writes only, the active
+ * curve, and the sums of all the curves when a limit moves
+ * only the last request counts : a request not started yet is replaced by
+ * the next one, and a result not taken yet by the next one
+ * the requests and the results are exchanged through atomic pointers
+ */
+class FitWorker : public QObject
+{
+	Q_OBJECT
+	friend class FitRunner;
+public:
+	explicit FitWorker(QObject* parent = 0);
+	~FitWorker();
+
+	/* all : the limits moved, fit all the curves, else only the active one
+	 * all the curves are fitted until the result of such a request is taken
+	 */
+	void submit(const CalibrationEngine& engine, bool all);
+
+	// the last result, 0 if none since the previous call, the caller owns it
+	FitJob* take();
+	// the result of a fit of all the curves is still to come
+	inline bool allPending() const { return m_allPending > 0; }
+
+	inline int submitted() const { return m_submitted; }
+	// requests and results replaced before being used
+	inline int superseded() const { return m_superseded.load(); }
+
+signals:
+	// a result can be taken
+	void ready();
+
+	// to the runner
+	void wake();
+
+private:
+	QThread m_thread;
+	QAtomicPointer<FitJob> m_job;
+	QAtomicPointer<FitJob> m_result;
+	QAtomicInt m_superseded;
+	// in the GUI thread
+	int m_submitted;
+	int m_allPending; // generation of the last request for all the curves, 0 when taken
+};
+
+#endif // FITWORKER_H
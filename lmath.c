@@ -3,35 +3,28 @@
 #include <math.h>
 
 /* P A = L U
- * P : permutation matrix
- * L : lower matrix
- * U : upper matrix
-*/
-static void
-lu_decomposition(int n, const double* A, double* P, double* L, double* U)
+ * P : permutation, row k of P A is row piv[k] of A
+ * L : lower matrix with unit diagonal, stored under the diagonal of LU
+ * U : upper matrix, stored on and above the diagonal of LU
+ */
+int lu_factor(lu_factorization* lu, int n, const double* A)
 {
 	int k,i,j,r;
 	double d, e;
-	r = 0; // To avoid warning: 'r' may be used uninitialized in this function
-
-	// P,L = identity
-	for (i = 0; i < n*n; ++i) {
-		P[i] = 0.0;
-		L[i] = 0.0;
-	}
-	for (i = 0; i < n*n; i += n+1) {
-		P[i] = 1.0;
-		L[i] = 1.0;
-	}
+	double* LU = lu->LU;
+	int* piv = lu->piv;
+	int res = 0;
 
-	// U = A
-	for (i = 0; i < n*n; ++i) U[i] = A[i];
+	lu->n = n;
+	if (LU != A) for (i = 0; i < n*n; ++i) LU[i] = A[i];
+	for (i = 0; i < n; ++i) piv[i] = i;
 
 	for (k = 0; k < n; ++k) {
 		// find maximum in column k
+		r = k;
 		d = -1.0;
 		for (i = k; i < n; ++i) {
-			e = fabs(U[i*n+k]);
+			e = fabs(LU[i*n+k]);
 			if (e > d) {
 				r = i;
 				d = e;
@@ -39,105 +32,137 @@ lu_decomposition(int n, const double* A, double* P, double* L, double* U)
 		}
 
 		if (d > 0.0) {
-			// swap lines r,k
+			// swap lines r,k (with the part of L already computed)
 			if (r != k) {
-				for (i = 0; i < n; ++i) {
-					d = U[r*n+i];
-					U[r*n+i] = U[k*n+i];
-					U[k*n+i] = d;
-
-					d = P[r*n+i];
-					P[r*n+i] = P[k*n+i];
-					P[k*n+i] = d;
-				}
-				for (i = 0; i < k; ++i) {
-					d = L[r*n+i];
-					L[r*n+i] = L[k*n+i];
-					L[k*n+i] = d;
+				for (j = 0; j < n; ++j) {
+					d = LU[r*n+j];
+					LU[r*n+j] = LU[k*n+j];
+					LU[k*n+j] = d;
 				}
+				i = piv[r];
+				piv[r] = piv[k];
+				piv[k] = i;
 			}
 
 			// make 0's
 			for (i = k+1; i < n; ++i) {
-				d = L[i*n+k] = U[i*n+k] / U[k*n+k];
-				for (j = 0; j < n; ++j)
-					U[i*n+j] -= d * U[k*n+j];
+				d = LU[i*n+k] /= LU[k*n+k];
+				for (j = k+1; j < n; ++j)
+					LU[i*n+j] -= d * LU[k*n+j];
 			}
+		} else {
+			res = 1;
 		}
 	}
+	return res;
 }
 
-/* LUx = b */
-static int
-solve_lu(int n, const double* L, const double* U, const double* b, double* x)
+/* LUx = Pb
+ * B : n x k Matrix, one right hand side per column
+ * X : n x k Matrix, can not be B, set to 0 if U is singular (as lu_solve does)
+ */
+int lu_solve_many(const lu_factorization* lu, int k, const double* B, double* X)
 {
+	int n = lu->n;
+	const double* LU = lu->LU;
+	int i, j, c;
+	double d;
+
+	// Ly = Pb, y is stored in X
+	for (i = 0; i < n; ++i) {
+		for (c = 0; c < k; ++c) X[i*k+c] = B[lu->piv[i]*k+c];
+		for (j = 0; j < i; ++j) {
+			d = LU[i*n+j];
+			for (c = 0; c < k; ++c) X[i*k+c] -= d * X[j*k+c];
+		}
+	}
+
+	// Ux = y
+	for (i = n-1; i >= 0; --i) {
+		d = LU[i*n+i];
+		if (d == 0.0) {
+			for (j = 0; j < n*k; ++j) X[j] = 0.0;
+			return 1;
+		}
+		for (j = i+1; j < n; ++j) {
+			for (c = 0; c < k; ++c) X[i*k+c] -= LU[i*n+j] * X[j*k+c];
+		}
+		for (c = 0; c < k; ++c) X[i*k+c] /= d;
+	}
+	return 0;
+}
+
+/* LUx = Pb */
+int lu_solve(const lu_factorization* lu, const double* b, double* x)
+{
+	int n = lu->n;
+	const double* LU = lu->LU;
 	int k, i;
-	int res = 0;
 	double s;
-	double* y = (double*)malloc(sizeof(double)*n);
-
-	for (i = 0; i < n; ++i) y[i] = 0.0;
 
-	// Ly = b
+	// Ly = Pb
 	for (k = 0; k < n; ++k) {
 		s = 0.0;
-		for (i = 0; i < n; ++i) s += L[k*n+i] * y[i];
-		y[k] = b[k] - s;
+		for (i = 0; i < k; ++i) s += LU[k*n+i] * x[i];
+		x[k] = b[lu->piv[k]] - s;
 	}
 
-	for (i = 0; i < n; ++i) x[i] = 0.0;
 	// Ux = y
 	for (k = n-1; k >= 0; --k) {
-		if (U[k*n+k] == 0.0) {
-			res = 1;
-			goto finish;
+		if (LU[k*n+k] == 0.0) {
+			for (i = 0; i < n; ++i) x[i] = 0.0;
+			return 1;
 		}
 		s = 0.0;
-		for (i = 0; i < n; ++i) s += U[k*n+i] * x[i];
-		x[k] = (y[k] - s) / U[k*n+k];
+		for (i = k+1; i < n; ++i) s += LU[k*n+i] * x[i];
+		x[k] = (x[k] - s) / LU[k*n+k];
 	}
-finish:
-	free(y);
-	return res;
+	return 0;
 }
 
 
+int solve_ls_workspace(int n)
+{
+	return SOLVE_LS_WORKSPACE(n);
+}
+
 /* Ax = b */
-int solve_ls(int n, const double* A, const double* b, double* x)
+int solve_ls_ws(int n, const double* A, const double* b, double* x, double* work, int* iwork)
 {
-	int i, k;
-	double *P,*L,*U,*Pb;
-	P  = (double*)malloc(sizeof(double)*n*n);
-	L  = (double*)malloc(sizeof(double)*n*n);
-	U  = (double*)malloc(sizeof(double)*n*n);
-	Pb = (double*)malloc(sizeof(double)*n);
+	lu_factorization lu;
+	lu.LU  = work;
+	lu.piv = iwork;
 
-	lu_decomposition(n, A, P, L, U);
+	lu_factor(&lu, n, A);
+	return lu_solve(&lu, b, x);
+}
 
-	for (i = 0; i < n; ++i) {
-		Pb[i] = 0;
-		for (k = 0; k < n; ++k) {
-			Pb[i] += P[i*n+k] * b[k];
-		}
-	}
-	i = solve_lu(n, L, U, Pb, x);
+int solve_ls(int n, const double* A, const double* b, double* x)
+{
+	int r;
+	double* work = (double*)malloc(sizeof(double)*solve_ls_workspace(n));
+	int* iwork = (int*)malloc(sizeof(int)*SOLVE_LS_IWORKSPACE(n));
+	r = solve_ls_ws(n, A, b, x, work, iwork);
+	free(iwork);
+	free(work);
+	return r;
+}
 
-	free(P);
-	free(L);
-	free(U);
-	free(Pb);
-	return i;
+int least_squares_workspace(int n, int m)
+{
+	(void)n;
+	return LEAST_SQUARES_WORKSPACE(m);
 }
 
 /* Solve min ||Ax - b|| where A is dimention nxm */
-int least_squares(int n, int m, const double* A, const double* b, double* x)
+int least_squares_ws(int n, int m, const double* A, const double* b, double* x, double* work, int* iwork)
 {
 	// m should be smaller than n
 
 	int i, j, k;
 	double d;
-	double *ATA = (double*)malloc(sizeof(double)*m*m);
-	double *ATb = (double*)malloc(sizeof(double)*m);
+	double *ATA = work;
+	double *ATb = ATA + m*m;
 
 	// compute A^t A
 	for (i = 0; i < m; ++i) {
@@ -159,10 +184,196 @@ int least_squares(int n, int m, const double* A, const double* b, double* x)
 		ATb[i] = d;
 	}
 
-	i = solve_ls(m, ATA, ATb, x);
-	free(ATA);
-	free(ATb);
-	return i;
+	return solve_ls_ws(m, ATA, ATb, x, ATb + m, iwork);
+}
+
+int least_squares(int n, int m, const double* A, const double* b, double* x)
+{
+	int r;
+	double* work = (double*)malloc(sizeof(double)*least_squares_workspace(n, m));
+	int* iwork = (int*)malloc(sizeof(int)*LEAST_SQUARES_IWORKSPACE(m));
+	r = least_squares_ws(n, m, A, b, x, work, iwork);
+	free(iwork);
+	free(work);
+	return r;
+}
+
+/* A = L L^t where A is symmetric positive definite
+ * L is written in the lower triangle of L (n x n), the upper part is not used
+ * return 1 if A is not positive definite
+ */
+int cholesky_factor(int n, const double* A, double* L)
+{
+	int i, j, k;
+	double d;
+
+	for (j = 0; j < n; ++j) {
+		d = A[j*n+j];
+		for (k = 0; k < j; ++k) d -= L[j*n+k] * L[j*n+k];
+		if (d <= 0.0) return 1;
+		L[j*n+j] = sqrt(d);
+
+		for (i = j+1; i < n; ++i) {
+			d = A[i*n+j];
+			for (k = 0; k < j; ++k) d -= L[i*n+k] * L[j*n+k];
+			L[i*n+j] = d / L[j*n+j];
+		}
+	}
+	return 0;
+}
+
+/* L L^t x = b */
+void cholesky_solve(int n, const double* L, const double* b, double* x)
+{
+	int i, k;
+	double s;
+
+	// Ly = b
+	for (i = 0; i < n; ++i) {
+		s = b[i];
+		for (k = 0; k < i; ++k) s -= L[i*n+k] * x[k];
+		x[i] = s / L[i*n+i];
+	}
+
+	// L^t x = y
+	for (i = n-1; i >= 0; --i) {
+		s = x[i];
+		for (k = i+1; k < n; ++k) s -= L[k*n+i] * x[k];
+		x[i] = s / L[i*n+i];
+	}
+}
+
+/* Solve min ||Ax - b|| with a Householder QR factorization of A
+ * A is never squared, the condition number is the one of A
+ * work : n*m + n doubles
+ * return 1 with x = 0 if A does not have full column rank
+ */
+static int
+qr_least_squares(int n, int m, const double* A, const double* b, double* x, double* work)
+{
+	int i, j, k;
+	double norm, alpha, vk, vtv, s;
+	double* R = work;
+	double* c = R + n*m;
+
+	for (i = 0; i < n*m; ++i) R[i] = A[i];
+	for (i = 0; i < n; ++i) c[i] = b[i];
+
+	for (k = 0; k < m; ++k) {
+		norm = 0.0;
+		for (i = k; i < n; ++i) norm += R[i*m+k] * R[i*m+k];
+		norm = sqrt(norm);
+		if (norm == 0.0) {
+			// rank deficient, x = 0 as the other backends do
+			for (i = 0; i < m; ++i) x[i] = 0.0;
+			return 1;
+		}
+
+		// v = column k - alpha e_k, H = I - 2 v v^t / v^t v
+		alpha = R[k*m+k] > 0.0 ? -norm : norm;
+		vk = R[k*m+k] - alpha;
+		vtv = vk * vk;
+		for (i = k+1; i < n; ++i) vtv += R[i*m+k] * R[i*m+k];
+
+		for (j = k+1; j < m; ++j) {
+			s = vk * R[k*m+j];
+			for (i = k+1; i < n; ++i) s += R[i*m+k] * R[i*m+j];
+			s = 2.0 * s / vtv;
+			R[k*m+j] -= s * vk;
+			for (i = k+1; i < n; ++i) R[i*m+j] -= s * R[i*m+k];
+		}
+
+		s = vk * c[k];
+		for (i = k+1; i < n; ++i) s += R[i*m+k] * c[i];
+		s = 2.0 * s / vtv;
+		c[k] -= s * vk;
+		for (i = k+1; i < n; ++i) c[i] -= s * R[i*m+k];
+
+		R[k*m+k] = alpha;
+	}
+
+	// R x = Q^t b
+	for (i = m-1; i >= 0; --i) {
+		s = c[i];
+		for (j = i+1; j < m; ++j) s -= R[i*m+j] * x[j];
+		x[i] = s / R[i*m+i];
+	}
+	return 0;
+}
+
+int least_squares_method_workspace(int n, int m)
+{
+	return LEAST_SQUARES_METHOD_WORKSPACE(n, m);
+}
+
+/* Solve min ||Ax - b|| with the given method
+ * LS_AUTO uses Cholesky on the normal equations when they are well
+ * conditioned enough and falls back on QR otherwise
+ */
+int least_squares_method_ws(int n, int m, const double* A, const double* b, double* x,
+									 int method, double* work, int* iwork)
+{
+	int i, j, k;
+	double d, lmin, lmax;
+	double *ATA, *ATb, *L;
+
+	if (method == LS_LU) return least_squares_ws(n, m, A, b, x, work, iwork);
+	if (method == LS_QR) return qr_least_squares(n, m, A, b, x, work);
+
+	ATA = work;
+	ATb = ATA + m*m;
+	L   = ATb + m;
+
+	// compute A^t A, only the lower triangle is used by cholesky_factor
+	for (i = 0; i < m; ++i) {
+		for (j = 0; j <= i; ++j) {
+			d = 0.0;
+			for (k = 0; k < n; ++k) d += A[k*m+i] * A[k*m+j];
+			ATA[i*m+j] = ATA[j*m+i] = d;
+		}
+		d = 0.0;
+		for (k = 0; k < n; ++k) d += A[k*m+i] * b[k];
+		ATb[i] = d;
+	}
+
+	if (cholesky_factor(m, ATA, L) != 0) {
+		if (method == LS_CHOLESKY) {
+			for (i = 0; i < m; ++i) x[i] = 0.0;
+			return 1;
+		}
+		return qr_least_squares(n, m, A, b, x, work);
+	}
+
+	if (method == LS_AUTO) {
+		// cond(A^t A) >= (max L_ii / min L_ii)^2
+		lmin = lmax = L[0];
+		for (i = 1; i < m; ++i) {
+			if (L[i*m+i] < lmin) lmin = L[i*m+i];
+			if (L[i*m+i] > lmax) lmax = L[i*m+i];
+		}
+		if ((lmax / lmin) * (lmax / lmin) > LS_AUTO_CONDITION_LIMIT)
+			return qr_least_squares(n, m, A, b, x, work);
+	}
+
+	cholesky_solve(m, L, ATb, x);
+	return 0;
+}
+
+int least_squares_method(int n, int m, const double* A, const double* b, double* x, int method)
+{
+	int r;
+	double* work = (double*)malloc(sizeof(double)*least_squares_method_workspace(n, m));
+	int* iwork = (int*)malloc(sizeof(int)*LEAST_SQUARES_METHOD_IWORKSPACE(n, m));
+	r = least_squares_method_ws(n, m, A, b, x, method, work, iwork);
+	free(iwork);
+	free(work);
+	return r;
+}
+
+int least_squares_constraint_workspace(int n, int m, int p)
+{
+	(void)n;
+	return LEAST_SQUARES_CONSTRAINT_WORKSPACE(m, p);
 }
 
 /* minimize || Ax - b || in x
@@ -177,10 +388,56 @@ int least_squares(int n, int m, const double* A, const double* b, double* x)
  * n = number of equations to minimize
  * p = number of equations to respect
  */
+int least_squares_constraint_ws(int n, int m, int p,
+									 const double* A, const double* b,
+									 const double* C, const double* e,
+									 double* x, double* work, int* iwork)
+{
+	int i, j, k;
+	double d;
+	double *ATA = work;
+	double *ATb = ATA + m*m;
+
+	for (i = 0; i < m; ++i) {
+		for (j = 0; j < m; ++j) {
+			d = 0.0;
+			for (k = 0; k < n; ++k) d += A[k*m+i] * A[k*m+j];
+			ATA[i*m+j] = d;
+		}
+		d = 0.0;
+		for (k = 0; k < n; ++k) d += A[k*m+i] * b[k];
+		ATb[i] = d;
+	}
+
+	return least_squares_constraint_normal_ws(m, p, ATA, ATb, C, e, x, ATb + m, iwork);
+}
+
 int least_squares_constraint(int n, int m, int p,
 								  const double* A, const double* b,
 								  const double* C, const double* e,
 								  double* x)
+{
+	int r;
+	double* work = (double*)malloc(sizeof(double)*least_squares_constraint_workspace(n, m, p));
+	int* iwork = (int*)malloc(sizeof(int)*LEAST_SQUARES_CONSTRAINT_IWORKSPACE(m, p));
+	r = least_squares_constraint_ws(n, m, p, A, b, C, e, x, work, iwork);
+	free(iwork);
+	free(work);
+	return r;
+}
+
+int least_squares_constraint_normal_workspace(int m, int p)
+{
+	return LEAST_SQUARES_CONSTRAINT_NORMAL_WORKSPACE(m, p);
+}
+
+/* Same as least_squares_constraint but A and b are given
+ * by the normal equations A^t A (m x m) and A^t b (m)
+ */
+int least_squares_constraint_normal_ws(int m, int p,
+											const double* ATA, const double* ATb,
+											const double* C, const double* e,
+											double* x, double* work, int* iwork)
 {
 	/* Solve the following system :
 	 * [2A^t A   -C^t] [x]   [2A^t b]
@@ -191,19 +448,14 @@ int least_squares_constraint(int n, int m, int p,
 
 	int i, j, k;
 	int u = p + m;
-	double tmp;
-	double* matrix = (double*)malloc(sizeof(double)*u*u);
-	double* sol   = (double*)malloc(sizeof(double)*u);
-	double* rhs   = (double*)malloc(sizeof(double)*u);
+	double* matrix = work;
+	double* sol    = matrix + u*u;
+	double* rhs    = sol + u;
 
 	// Write in matrix
-	//for (i = 0; i < u*u; ++i) matrix[i] = 0.0;
+	for (i = 0; i < m; ++i) for (j = 0; j < m; ++j)
+		matrix[  i  *u+  j] = 2.0 * ATA[i*m+j];
 
-	for (i = 0; i < m; ++i) for (j = 0; j < m; ++j) {
-		tmp = 0.0;
-		for (k = 0; k < n; ++k) tmp += A[k*m+i] * A[k*m+j];
-		matrix[  i  *u+  j] = 2.0 * tmp;
-	}
 	for (i = 0; i < m; ++i) for (j = 0; j < p; ++j)
 		matrix[  i  *u+m+j] = -C[j*m+i];
 
@@ -214,25 +466,111 @@ int least_squares_constraint(int n, int m, int p,
 		matrix[(m+i)*u+m+j] =  0.0;
 
 	// Write in newb
-	for (i = 0; i < m; ++i) {
-		tmp = 0.0;
-		for (k = 0; k < n; ++k) tmp += A[k*m+i] * b[k];
-		rhs[i] = 2 * tmp;
-	}
+	for (i = 0; i < m; ++i)
+		rhs[i] = 2.0 * ATb[i];
 	for (i = 0; i < p; ++i)
 		rhs[m+i] = e[i];
 
 	// Solve the system
-	k = solve_ls(u, matrix, rhs, sol);
+	k = solve_ls_ws(u, matrix, rhs, sol, rhs + u, iwork);
 
 	for (i = 0; i < m; ++i) x[i] = sol[i];
 
-	free(matrix);
-	free(rhs);
-	free(sol);
 	return k;
 }
 
+int least_squares_constraint_normal(int m, int p,
+										 const double* ATA, const double* ATb,
+										 const double* C, const double* e,
+										 double* x)
+{
+	int r;
+	double* work = (double*)malloc(sizeof(double)*least_squares_constraint_normal_workspace(m, p));
+	int* iwork = (int*)malloc(sizeof(int)*LEAST_SQUARES_CONSTRAINT_NORMAL_IWORKSPACE(m, p));
+	r = least_squares_constraint_normal_ws(m, p, ATA, ATb, C, e, x, work, iwork);
+	free(iwork);
+	free(work);
+	return r;
+}
+
+void ls_accumulator_init(ls_accumulator* acc, int m)
+{
+	int i;
+	acc->m = m;
+	acc->rows = 0.0;
+	for (i = 0; i < m*m; ++i) acc->ATA[i] = 0.0;
+	for (i = 0; i < m; ++i) acc->ATb[i] = 0.0;
+	acc->btb = 0.0;
+}
+
+static void
+ls_accumulator_update(ls_accumulator* acc, const double* a, double b, double w)
+{
+	int i, j;
+	int m = acc->m;
+
+	// only the upper triangle, A^t A is symmetric
+	for (i = 0; i < m; ++i) {
+		for (j = i; j < m; ++j) acc->ATA[i*m+j] += w * a[i] * a[j];
+		acc->ATb[i] += w * a[i] * b;
+	}
+	for (i = 0; i < m; ++i) for (j = 0; j < i; ++j)
+		acc->ATA[i*m+j] = acc->ATA[j*m+i];
+
+	acc->btb += w * b * b;
+	acc->rows += w;
+}
+
+void ls_accumulator_add_row(ls_accumulator* acc, const double* a, double b)
+{
+	ls_accumulator_update(acc, a, b, 1.0);
+}
+
+void ls_accumulator_remove_row(ls_accumulator* acc, const double* a, double b)
+{
+	ls_accumulator_update(acc, a, b, -1.0);
+}
+
+void ls_accumulator_merge(ls_accumulator* acc, const ls_accumulator* other)
+{
+	int i;
+	int m = acc->m;
+	for (i = 0; i < m*m; ++i) acc->ATA[i] += other->ATA[i];
+	for (i = 0; i < m; ++i) acc->ATb[i] += other->ATb[i];
+	acc->btb += other->btb;
+	acc->rows += other->rows;
+}
+
+int ls_accumulator_solve(const ls_accumulator* acc, double* x)
+{
+	double work[SOLVE_LS_WORKSPACE(LS_ACCUMULATOR_MAX)];
+	int iwork[SOLVE_LS_IWORKSPACE(LS_ACCUMULATOR_MAX)];
+	return solve_ls_ws(acc->m, acc->ATA, acc->ATb, x, work, iwork);
+}
+
+int ls_accumulator_solve_constraint(const ls_accumulator* acc, int p,
+									const double* C, const double* e,
+									double* x)
+{
+	double work[LEAST_SQUARES_CONSTRAINT_NORMAL_WORKSPACE(LS_ACCUMULATOR_MAX, LS_ACCUMULATOR_MAX)];
+	int iwork[LEAST_SQUARES_CONSTRAINT_NORMAL_IWORKSPACE(LS_ACCUMULATOR_MAX, LS_ACCUMULATOR_MAX)];
+	return least_squares_constraint_normal_ws(acc->m, p, acc->ATA, acc->ATb, C, e, x, work, iwork);
+}
+
+/* ||Ax - b||^2 = x^t A^t A x - 2 x^t A^t b + b^t b */
+double ls_accumulator_residual(const ls_accumulator* acc, const double* x)
+{
+	int i, j;
+	int m = acc->m;
+	double r = acc->btb;
+	for (i = 0; i < m; ++i) {
+		double d = 0.0;
+		for (j = 0; j < m; ++j) d += acc->ATA[i*m+j] * x[j];
+		r += x[i] * (d - 2.0 * acc->ATb[i]);
+	}
+	return r;
+}
+
 double polynomial_evaluate(int n, const double* poly, double x)
 {
 	double y = poly[0];
@@ -242,3 +580,12 @@ double polynomial_evaluate(int n, const double* poly, double x)
 	}
 	return y;
 }
+
+long long polynomial_evaluate_fixed(int n, const long long* poly, long long x, int q)
+{
+	long long y = poly[0];
+	for (int i = 1; i < n; ++i) {
+		y = ((y * x) >> q) + poly[i];
+	}
+	return y;
+}
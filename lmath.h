@@ -1,20 +1,100 @@
 #ifndef LMATH_H
 #define LMATH_H
 
+/* Every solver has a _ws variant that does no allocation :
+ * work must point to at least *_workspace() doubles (or the size given by
+ * the macro of the same name, usable for arrays on the stack)
+ * and iwork to at least *_IWORKSPACE() ints, the pivots of the LU factorization
+ */
+#define SOLVE_LS_WORKSPACE(n) ((n)*(n))
+#define SOLVE_LS_IWORKSPACE(n) (n)
+#define LEAST_SQUARES_IWORKSPACE(m) (m)
+#define LEAST_SQUARES_CONSTRAINT_NORMAL_IWORKSPACE(m, p) ((m)+(p))
+#define LEAST_SQUARES_CONSTRAINT_IWORKSPACE(m, p) ((m)+(p))
+#define LEAST_SQUARES_WORKSPACE(m) ((m)*(m) + (m) + SOLVE_LS_WORKSPACE(m))
+#define LEAST_SQUARES_CONSTRAINT_NORMAL_WORKSPACE(m, p) \
+	(((m)+(p))*((m)+(p)) + 2*((m)+(p)) + SOLVE_LS_WORKSPACE((m)+(p)))
+#define LEAST_SQUARES_CONSTRAINT_WORKSPACE(m, p) \
+	((m)*(m) + (m) + LEAST_SQUARES_CONSTRAINT_NORMAL_WORKSPACE(m, p))
+
+/* LU factorization with partial pivoting, P A = L U
+ * L and U are packed in LU (n x n), the pivots in piv (n)
+ * the caller provides the storage of LU and piv
+ * factor once and solve for as many right hand sides as needed
+ */
+typedef struct lu_factorization {
+	int n;
+	double* LU;
+	int* piv;
+} lu_factorization;
+
+/* A can be lu->LU to factor in place, return 1 if A is singular */
+int lu_factor(lu_factorization* lu, int n, const double* A);
+
+/* Solve Ax = b */
+int lu_solve(const lu_factorization* lu, const double* b, double* x);
+
+/* Solve AX = B, B and X are n x k Matrices (one right hand side per column)
+ * as lu_solve, X is set to 0 and 1 is returned if A is singular */
+int lu_solve_many(const lu_factorization* lu, int k, const double* B, double* X);
+
+
+
 /* Solve Ax = b where A is square with an LU factorization */
 int solve_ls(int n, const double* A, const double* b, double* x);
+int solve_ls_ws(int n, const double* A, const double* b, double* x, double* work, int* iwork);
+int solve_ls_workspace(int n);
 
 
 
 
 /* Solve min ||Ax - b|| where A is dimention nxm */
 int least_squares(int n, int m, const double* A, const double* b, double* x);
+int least_squares_ws(int n, int m, const double* A, const double* b, double* x, double* work, int* iwork);
+int least_squares_workspace(int n, int m);
 
 
 
 
 
 
+/* Backends of least squares
+ * LS_LU       : normal equations solved with an LU factorization (least_squares)
+ * LS_CHOLESKY : normal equations solved with a Cholesky factorization
+ * LS_QR       : Householder QR on A, does not square the condition number
+ * LS_AUTO     : Cholesky, or QR if cond(A^t A) is estimated above LS_AUTO_CONDITION_LIMIT
+ *               the estimate comes from the diagonal of the Cholesky factor, so an ill
+ *               conditioned problem pays A^t A and its factorization (n m^2 + m^3 / 3)
+ *               before the QR (2 n m^2), about 1.5 times the cost of LS_QR alone
+ * every method returns 1 with x = 0 when it cannot solve the problem
+ */
+enum ls_method {
+	LS_AUTO = 0,
+	LS_LU,
+	LS_CHOLESKY,
+	LS_QR
+};
+
+#define LS_AUTO_CONDITION_LIMIT 1e8
+#define LEAST_SQUARES_METHOD_WORKSPACE(n, m) ((n)*(m) + (n) + 2*(m)*(m) + 2*(m))
+#define LEAST_SQUARES_METHOD_IWORKSPACE(n, m) (m)
+
+int least_squares_method(int n, int m, const double* A, const double* b, double* x, int method);
+int least_squares_method_ws(int n, int m, const double* A, const double* b, double* x,
+									 int method, double* work, int* iwork);
+int least_squares_method_workspace(int n, int m);
+
+/* A = L L^t, return 1 if A is not symmetric positive definite
+ * L : n x n, only its lower triangle is written
+ */
+int cholesky_factor(int n, const double* A, double* L);
+
+/* L L^t x = b */
+void cholesky_solve(int n, const double* L, const double* b, double* x);
+
+
+
+
 /* minimize || Ax - b || in x
  * under constraint Cx = e
  *
@@ -27,9 +107,72 @@ int least_squares_constraint(int n, int m, int p,
 								  const double* A, const double* b,
 								  const double* C, const double* e,
 								  double* x);
+int least_squares_constraint_ws(int n, int m, int p,
+									 const double* A, const double* b,
+									 const double* C, const double* e,
+									 double* x, double* work, int* iwork);
+int least_squares_constraint_workspace(int n, int m, int p);
+
+/* Same as least_squares_constraint but the problem is given
+ * by its normal equations instead of A and b
+ *
+ * ATA : m x m Matrix (A^t A)
+ * ATb : m Vector     (A^t b)
+ */
+int least_squares_constraint_normal(int m, int p,
+										 const double* ATA, const double* ATb,
+										 const double* C, const double* e,
+										 double* x);
+int least_squares_constraint_normal_ws(int m, int p,
+											const double* ATA, const double* ATb,
+											const double* C, const double* e,
+											double* x, double* work, int* iwork);
+int least_squares_constraint_normal_workspace(int m, int p);
+
+
+
+/* Streaming least squares : the rows of A and b are pushed one by one
+ * and only A^t A, A^t b and b^t b are kept in memory
+ * m must be smaller or equal to LS_ACCUMULATOR_MAX
+ * the solves do no allocation (p must be smaller or equal to LS_ACCUMULATOR_MAX)
+ */
+#define LS_ACCUMULATOR_MAX 8
+
+typedef struct ls_accumulator {
+	int m;
+	double rows; // number of rows pushed
+	double ATA[LS_ACCUMULATOR_MAX*LS_ACCUMULATOR_MAX];
+	double ATb[LS_ACCUMULATOR_MAX];
+	double btb;
+} ls_accumulator;
+
+void ls_accumulator_init(ls_accumulator* acc, int m);
+
+/* a : m Vector, one row of A */
+void ls_accumulator_add_row(ls_accumulator* acc, const double* a, double b);
+void ls_accumulator_remove_row(ls_accumulator* acc, const double* a, double b);
+
+/* acc += other, both must have the same m */
+void ls_accumulator_merge(ls_accumulator* acc, const ls_accumulator* other);
+
+/* Solve min ||Ax - b|| */
+int ls_accumulator_solve(const ls_accumulator* acc, double* x);
+
+/* Solve min ||Ax - b|| under constraint Cx = e */
+int ls_accumulator_solve_constraint(const ls_accumulator* acc, int p,
+									const double* C, const double* e,
+									double* x);
+
+/* ||Ax - b||^2 */
+double ls_accumulator_residual(const ls_accumulator* acc, const double* x);
 
 
 
 double polynomial_evaluate(int n, const double* poly, double x);
 
+/* Same in fixed point with q fractional bits (poly and x are multiplied by 2^q)
+ * the products are rounded toward minus infinity, as in the patched driver
+ */
+long long polynomial_evaluate_fixed(int n, const long long* poly, long long x, int q);
+
 #endif // LMATH_H
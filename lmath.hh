@@ -0,0 +1,432 @@
+#ifndef LMATH_HH
+#define LMATH_HH
+
+extern "C" {
+#include "lmath.h"
+}
+
+/* Compile-time sized versions of the lmath solvers
+ *
+ * They use the same algorithms as lmath.c (same pivoting, same order of
+ * the operations) and give the same results, but all the arrays are on the
+ * stack and all the loops have a constant trip count and are unrolled.
+ * The runtime sized functions of lmath.h remain for the other sizes.
+ */
+
+#if defined(__clang__)
+#define LMATH_UNROLL _Pragma("unroll")
+#elif defined(__GNUC__) && __GNUC__ >= 8
+#define LMATH_UNROLL _Pragma("GCC unroll 16")
+#else
+#define LMATH_UNROLL
+#endif
+
+#if defined(__clang__)
+#define LMATH_SIMD _Pragma("clang loop vectorize(enable)")
+#elif defined(__GNUC__)
+#define LMATH_SIMD _Pragma("GCC ivdep")
+#else
+#define LMATH_SIMD
+#endif
+
+namespace lmath {
+
+/* P A = L U in place, see lu_factor() in lmath.h
+ * LU : N x N, holds A on input
+ * piv : N
+ */
+template<int N>
+inline int lu_factor(double* LU, int* piv)
+{
+	int res = 0;
+
+	LMATH_UNROLL
+	for (int i = 0; i < N; ++i) piv[i] = i;
+
+	LMATH_UNROLL
+	for (int k = 0; k < N; ++k) {
+		// find maximum in column k
+		int r = k;
+		double d = -1.0;
+		LMATH_UNROLL
+		for (int i = k; i < N; ++i) {
+			double e = LU[i*N+k] < 0.0 ? -LU[i*N+k] : LU[i*N+k];
+			if (e > d) {
+				r = i;
+				d = e;
+			}
+		}
+		if (d > 0.0) {
+			// swap lines r,k
+			if (r != k) {
+				LMATH_UNROLL
+				for (int j = 0; j < N; ++j) {
+					double t = LU[r*N+j];
+					LU[r*N+j] = LU[k*N+j];
+					LU[k*N+j] = t;
+				}
+				int t = piv[r];
+				piv[r] = piv[k];
+				piv[k] = t;
+			}
+
+			// make 0's
+			LMATH_UNROLL
+			for (int i = k+1; i < N; ++i) {
+				double l = LU[i*N+k] /= LU[k*N+k];
+				LMATH_UNROLL
+				for (int j = k+1; j < N; ++j) LU[i*N+j] -= l * LU[k*N+j];
+			}
+		} else {
+			res = 1;
+		}
+	}
+	return res;
+}
+
+/* LUx = Pb */
+template<int N>
+inline int lu_solve(const double* LU, const int* piv, const double* b, double* x)
+{
+	// Ly = Pb
+	LMATH_UNROLL
+	for (int k = 0; k < N; ++k) {
+		double s = 0.0;
+		LMATH_UNROLL
+		for (int i = 0; i < k; ++i) s += LU[k*N+i] * x[i];
+		x[k] = b[piv[k]] - s;
+	}
+
+	// Ux = y
+	LMATH_UNROLL
+	for (int k = N-1; k >= 0; --k) {
+		if (LU[k*N+k] == 0.0) {
+			LMATH_UNROLL
+			for (int i = 0; i < N; ++i) x[i] = 0.0;
+			return 1;
+		}
+		double s = 0.0;
+		LMATH_UNROLL
+		for (int i = k+1; i < N; ++i) s += LU[k*N+i] * x[i];
+		x[k] = (x[k] - s) / LU[k*N+k];
+	}
+	return 0;
+}
+
+/* LUX = PB, B and X are N x K Matrices, X is set to 0 if U is singular */
+template<int N, int K>
+inline int lu_solve_many(const double* LU, const int* piv, const double* B, double* X)
+{
+	// Ly = Pb
+	LMATH_UNROLL
+	for (int i = 0; i < N; ++i) {
+		LMATH_UNROLL
+		for (int c = 0; c < K; ++c) X[i*K+c] = B[piv[i]*K+c];
+		LMATH_UNROLL
+		for (int j = 0; j < i; ++j) {
+			LMATH_UNROLL
+			for (int c = 0; c < K; ++c) X[i*K+c] -= LU[i*N+j] * X[j*K+c];
+		}
+	}
+
+	// Ux = y
+	LMATH_UNROLL
+	for (int i = N-1; i >= 0; --i) {
+		double d = LU[i*N+i];
+		if (d == 0.0) {
+			LMATH_UNROLL
+			for (int j = 0; j < N*K; ++j) X[j] = 0.0;
+			return 1;
+		}
+		LMATH_UNROLL
+		for (int j = i+1; j < N; ++j) {
+			LMATH_UNROLL
+			for (int c = 0; c < K; ++c) X[i*K+c] -= LU[i*N+j] * X[j*K+c];
+		}
+		LMATH_UNROLL
+		for (int c = 0; c < K; ++c) X[i*K+c] /= d;
+	}
+	return 0;
+}
+
+/* Solve Ax = b where A is N x N with an LU factorization */
+template<int N>
+inline int solve_ls(const double* A, const double* b, double* x)
+{
+	double LU[N*N];
+	int piv[N];
+
+	LMATH_UNROLL
+	for (int i = 0; i < N*N; ++i) LU[i] = A[i];
+
+	lu_factor<N>(LU, piv);
+	return lu_solve<N>(LU, piv, b, x);
+}
+
+/* Solve min ||Ax - b|| where A is dimention n x M */
+template<int M>
+inline int least_squares(int n, const double* A, const double* b, double* x)
+{
+	double ATA[M*M];
+	double ATb[M];
+
+	LMATH_UNROLL
+	for (int i = 0; i < M; ++i) {
+		LMATH_UNROLL
+		for (int j = 0; j < M; ++j) {
+			double d = 0.0;
+			for (int k = 0; k < n; ++k) d += A[k*M+i] * A[k*M+j];
+			ATA[i*M+j] = d;
+		}
+		double d = 0.0;
+		for (int k = 0; k < n; ++k) d += A[k*M+i] * b[k];
+		ATb[i] = d;
+	}
+
+	return solve_ls<M>(ATA, ATb, x);
+}
+
+/* minimize || Ax - b || in x under constraint Cx = e
+ * given the normal equations A^t A (M x M) and A^t b (M)
+ * C : P x M Matrix
+ * e : P Vector
+ */
+template<int M, int P>
+inline int least_squares_constraint_normal(const double* ATA, const double* ATb,
+														 const double* C, const double* e,
+														 double* x)
+{
+	const int U = M + P;
+	double matrix[U*U];
+	double rhs[U];
+	double sol[U];
+
+	LMATH_UNROLL
+	for (int i = 0; i < M; ++i) {
+		LMATH_UNROLL
+		for (int j = 0; j < M; ++j) matrix[i*U+j] = 2.0 * ATA[i*M+j];
+		LMATH_UNROLL
+		for (int j = 0; j < P; ++j) matrix[i*U+M+j] = -C[j*M+i];
+		rhs[i] = 2.0 * ATb[i];
+	}
+	LMATH_UNROLL
+	for (int i = 0; i < P; ++i) {
+		LMATH_UNROLL
+		for (int j = 0; j < M; ++j) matrix[(M+i)*U+j] = C[i*M+j];
+		LMATH_UNROLL
+		for (int j = 0; j < P; ++j) matrix[(M+i)*U+M+j] = 0.0;
+		rhs[M+i] = e[i];
+	}
+
+	int r = solve_ls<U>(matrix, rhs, sol);
+
+	LMATH_UNROLL
+	for (int i = 0; i < M; ++i) x[i] = sol[i];
+	return r;
+}
+
+/* minimize || Ax - b || in x under constraint Cx = e
+ * A : n x M Matrix
+ */
+template<int M, int P>
+inline int least_squares_constraint(int n, const double* A, const double* b,
+												const double* C, const double* e,
+												double* x)
+{
+	double ATA[M*M];
+	double ATb[M];
+
+	LMATH_UNROLL
+	for (int i = 0; i < M; ++i) {
+		LMATH_UNROLL
+		for (int j = 0; j < M; ++j) {
+			double d = 0.0;
+			for (int k = 0; k < n; ++k) d += A[k*M+i] * A[k*M+j];
+			ATA[i*M+j] = d;
+		}
+		double d = 0.0;
+		for (int k = 0; k < n; ++k) d += A[k*M+i] * b[k];
+		ATb[i] = d;
+	}
+
+	return least_squares_constraint_normal<M, P>(ATA, ATb, C, e, x);
+}
+
+/* Solve an accumulator whose m is M */
+template<int M>
+inline int solve(const ls_accumulator& acc, double* x)
+{
+	return solve_ls<M>(acc.ATA, acc.ATb, x);
+}
+
+template<int M, int P>
+inline int solve_constraint(const ls_accumulator& acc, const double* C, const double* e, double* x)
+{
+	return least_squares_constraint_normal<M, P>(acc.ATA, acc.ATb, C, e, x);
+}
+
+/* Batched solvers : count independent systems of the same shape are
+ * solved together. They are stored as structure of arrays, element e of
+ * system s is at [e*count + s], so that the inner loops run over the
+ * systems and are vectorized.
+ * A system with a zero pivot gets x = 0 and makes the result 1.
+ */
+
+/* Solve A_s x_s = b_s
+ * A : N*N*count, b and x : N*count
+ * work : solve_ls_batch_workspace<N>(count) doubles
+ */
+template<int N>
+inline int solve_ls_batch_workspace(int count)
+{
+	return N*N*count;
+}
+
+template<int N>
+inline int solve_ls_batch(int count, const double* A, const double* b, double* x, double* work)
+{
+	double* LU = work;
+	int res = 0;
+
+	for (int i = 0; i < N*N*count; ++i) LU[i] = A[i];
+	for (int i = 0; i < N*count; ++i) x[i] = b[i];
+
+	LMATH_UNROLL
+	for (int k = 0; k < N; ++k) {
+		// the pivot is chosen system by system, the right hand side follows the rows
+		for (int s = 0; s < count; ++s) {
+			int r = k;
+			double d = -1.0;
+			LMATH_UNROLL
+			for (int i = k; i < N; ++i) {
+				double e = LU[(i*N+k)*count+s] < 0.0 ? -LU[(i*N+k)*count+s] : LU[(i*N+k)*count+s];
+				if (e > d) {
+					r = i;
+					d = e;
+				}
+			}
+			if (r != k) {
+				LMATH_UNROLL
+				for (int j = 0; j < N; ++j) {
+					double t = LU[(r*N+j)*count+s];
+					LU[(r*N+j)*count+s] = LU[(k*N+j)*count+s];
+					LU[(k*N+j)*count+s] = t;
+				}
+				double t = x[r*count+s];
+				x[r*count+s] = x[k*count+s];
+				x[k*count+s] = t;
+			}
+		}
+
+		// make 0's, and Ly = Pb at the same time
+		const double* p = LU + (k*N+k)*count;
+		const double* y = x + k*count;
+		LMATH_UNROLL
+		for (int i = k+1; i < N; ++i) {
+			double* l = LU + (i*N+k)*count;
+			LMATH_SIMD
+			for (int s = 0; s < count; ++s) l[s] = p[s] != 0.0 ? l[s] / p[s] : 0.0;
+
+			LMATH_UNROLL
+			for (int j = k+1; j < N; ++j) {
+				double* u = LU + (i*N+j)*count;
+				const double* v = LU + (k*N+j)*count;
+				LMATH_SIMD
+				for (int s = 0; s < count; ++s) u[s] -= l[s] * v[s];
+			}
+
+			double* z = x + i*count;
+			LMATH_SIMD
+			for (int s = 0; s < count; ++s) z[s] -= l[s] * y[s];
+		}
+	}
+
+	// Ux = y
+	LMATH_UNROLL
+	for (int k = N-1; k >= 0; --k) {
+		double* z = x + k*count;
+		LMATH_UNROLL
+		for (int j = k+1; j < N; ++j) {
+			const double* u = LU + (k*N+j)*count;
+			const double* v = x + j*count;
+			LMATH_SIMD
+			for (int s = 0; s < count; ++s) z[s] -= u[s] * v[s];
+		}
+		const double* p = LU + (k*N+k)*count;
+		LMATH_SIMD
+		for (int s = 0; s < count; ++s) z[s] = p[s] != 0.0 ? z[s] / p[s] : 0.0;
+	}
+
+	for (int s = 0; s < count; ++s) {
+		for (int k = 0; k < N; ++k) {
+			if (LU[(k*N+k)*count+s] == 0.0) {
+				for (int i = 0; i < N; ++i) x[i*count+s] = 0.0;
+				res = 1;
+				break;
+			}
+		}
+	}
+	return res;
+}
+
+/* minimize || A_s x_s - b_s || under constraint C_s x_s = e_s
+ * given the normal equations
+ * ATA : M*M*count, ATb : M*count, C : P*M*count, e : P*count, x : M*count
+ * work : least_squares_constraint_normal_batch_workspace<M, P>(count) doubles
+ */
+template<int M, int P>
+inline int least_squares_constraint_normal_batch_workspace(int count)
+{
+	return (M+P)*(M+P)*count + 2*(M+P)*count + solve_ls_batch_workspace<M+P>(count);
+}
+
+template<int M, int P>
+inline int least_squares_constraint_normal_batch(int count, const double* ATA, const double* ATb,
+																	const double* C, const double* e,
+																	double* x, double* work)
+{
+	const int U = M + P;
+	double* matrix = work;
+	double* rhs = matrix + U*U*count;
+	double* sol = rhs + U*count;
+
+	LMATH_UNROLL
+	for (int i = 0; i < M; ++i) {
+		LMATH_UNROLL
+		for (int j = 0; j < M; ++j) {
+			LMATH_SIMD
+			for (int s = 0; s < count; ++s) matrix[(i*U+j)*count+s] = 2.0 * ATA[(i*M+j)*count+s];
+		}
+		LMATH_UNROLL
+		for (int j = 0; j < P; ++j) {
+			LMATH_SIMD
+			for (int s = 0; s < count; ++s) matrix[(i*U+M+j)*count+s] = -C[(j*M+i)*count+s];
+		}
+		LMATH_SIMD
+		for (int s = 0; s < count; ++s) rhs[i*count+s] = 2.0 * ATb[i*count+s];
+	}
+	LMATH_UNROLL
+	for (int i = 0; i < P; ++i) {
+		LMATH_UNROLL
+		for (int j = 0; j < M; ++j) {
+			LMATH_SIMD
+			for (int s = 0; s < count; ++s) matrix[((M+i)*U+j)*count+s] = C[(i*M+j)*count+s];
+		}
+		LMATH_UNROLL
+		for (int j = 0; j < P; ++j) {
+			LMATH_SIMD
+			for (int s = 0; s < count; ++s) matrix[((M+i)*U+M+j)*count+s] = 0.0;
+		}
+		LMATH_SIMD
+		for (int s = 0; s < count; ++s) rhs[(M+i)*count+s] = e[i*count+s];
+	}
+
+	int r = solve_ls_batch<U>(count, matrix, rhs, sol, sol + U*count);
+
+	for (int i = 0; i < M*count; ++i) x[i] = sol[i];
+	return r;
+}
+
+} // namespace lmath
+
+#endif // LMATH_HH
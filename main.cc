@@ -1,14 +1,69 @@
 #include "calibrationwidget.hh"
+#include "batch.hh"
+#include "devicebackend.hh"
+#include "propertyqueue.hh"
 #include <QApplication>
+#include <QCommandLineParser>
+#include <QScopedPointer>
+#include <cstring>
 
 int main(int argc, char *argv[])
 {
-	QApplication app(argc, argv);
-	app.setApplicationName("wacom-distortion");
+	// the batch mode runs without window server
+	bool batch = false;
+	for (int i = 1; i < argc; ++i) {
+		if (strncmp(argv[i], "--batch", 7) == 0) batch = true; // also --batch=<session>
+	}
+	QScopedPointer<QCoreApplication> app(batch ? new QCoreApplication(argc, argv) : new QApplication(argc, argv));
+	app->setApplicationName("wacom-distortion");
 
-	CalibrationWidget w(app.arguments().value(1, "<Your device>"));
+	QCommandLineParser parser;
+	parser.setApplicationDescription("Calibration tool for wacom stylus");
+	parser.addHelpOption();
+	parser.addPositionalArgument("device", "Name of the stylus device (see xinput)");
+	QCommandLineOption tableOption("table", "Also upload the correction as a lookup table of <entries> per axis (2 to 4096)", "entries");
+	parser.addOption(tableOption);
+	QCommandLineOption recordOption("record", "Record the tablet events of the session in <file>, see wacom-replay", "file");
+	parser.addOption(recordOption);
+	QCommandLineOption batchOption("batch", "Calibrate without GUI from the recorded <session>, can be repeated", "session");
+	parser.addOption(batchOption);
+	QCommandLineOption applyOption("apply", "With --batch, set the properties of the device instead of printing the commands");
+	parser.addOption(applyOption);
+	QCommandLineOption xinputOption("xinput", "Run the xinput program instead of using libXi");
+	parser.addOption(xinputOption);
+	QCommandLineOption resampleOption("resample", "Fit the lines resampled every <pixels> instead of all the tablet samples", "pixels");
+	parser.addOption(resampleOption);
+	QCommandLineOption rescanOption("rescan", "Ignore the device and the area remembered from the previous calibration");
+	parser.addOption(rescanOption);
+	QCommandLineOption autoLimitsOption("auto-limits", "Place the border limits where the lines are fitted the best, until one is dragged");
+	parser.addOption(autoLimitsOption);
+	parser.process(*app);
+
+	QString device = parser.positionalArguments().value(0, "<Your device>");
+	int tableSize = 0;
+	if (parser.isSet(tableOption)) tableSize = qBound(2, parser.value(tableOption).toInt(), 4096);
+
+	bool native = !parser.isSet(xinputOption);
+	double spacing = qMax(0.0, parser.value(resampleOption).toDouble());
+
+	if (batch) {
+		QScopedPointer<DeviceBackend> backend(parser.isSet(applyOption) ? DeviceBackend::create(native) : 0);
+		return runBatch(parser.values(batchOption), device, backend.data(), tableSize, spacing,
+							 parser.isSet(autoLimitsOption)) == 0 ? 0 : 1;
+	}
+
+	// the properties are applied in another thread
+	PropertyQueue queue(native);
+
+	CalibrationWidget w(device);
+	w.setPropertyQueue(&queue);
+	w.setDistortionTableSize(tableSize);
+	w.setResampleSpacing(spacing);
+	w.setAutoLimits(parser.isSet(autoLimitsOption));
+	if (parser.isSet(recordOption)) w.setRecordFile(parser.value(recordOption));
+	w.setDeviceCacheEnabled(!parser.isSet(rescanOption));
 	w.show();
 	w.nextStep();
 
-	return app.exec();
+	return app->exec();
 }
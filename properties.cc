@@ -0,0 +1,120 @@
+#include "properties.hh"
+#include <QProcess>
+#include <QStringList>
+
+QString resetDistortionTableCommand(const QString& device)
+{
+	QString command = "xinput set-int-prop \"%1\" \"Wacom Border Distortion Table\" 32 0 0";
+	return command.arg(device);
+}
+
+QString listPropertiesCommand(const QString& device)
+{
+	QString command = "xinput list-props \"%1\"";
+	return command.arg(device);
+}
+
+QString areaCommand(const QString& device, const QVector<int>& area)
+{
+	QString command = "xinput set-int-prop \"%1\" \"Wacom Tablet Area\" 32 %2 %3 %4 %5";
+	return command.arg(device).arg(area[0]).arg(area[1]).arg(area[2]).arg(area[3]);
+}
+
+QString distortionCommand(const QString& device, const QVector<double>& distortion)
+{
+	QString command = "xinput set-float-prop \"%1\" \"Wacom Border Distortion\"";
+	command = command.arg(device);
+	for (int i = 0; i < distortion.size(); ++i) {
+		// enough digits to give the exact float
+		command += QString(" %1").arg(distortion[i], 0, 'g', 17);
+	}
+	return command;
+}
+
+QString distortionTableCommand(const QString& device, int entries, const QVector<int>& table)
+{
+	QString command = "xinput set-int-prop \"%1\" \"Wacom Border Distortion Table\" 32 %2 %2";
+	command = command.arg(device).arg(entries);
+	for (int i = 0; i < table.size(); ++i) command += QString(" %1").arg(table[i]);
+	return command;
+}
+
+// the values of an integer property in the output of xinput list-props
+static QVector<int> parseProperty(const QByteArray& properties, const char* name, int count)
+{
+	QVector<int> values;
+	int pos = properties.indexOf(name);
+	if (pos != -1) {
+		pos = properties.indexOf(':', pos);
+		pos++; // ignore the ':'
+		int end = properties.indexOf('\n', pos);
+		QString svalues(properties.mid(pos, end-pos));
+		QStringList list = svalues.split(",", QString::SkipEmptyParts);
+		if (list.size() == count) {
+			for (int i = 0; i < list.size(); ++i) {
+				bool ok;
+				values << list[i].trimmed().toInt(&ok);
+				if (!ok) {
+					values.clear();
+					break;
+				}
+			}
+		}
+	}
+	return values;
+}
+
+QVector<int> parseArea(const QByteArray& properties)
+{
+	return parseProperty(properties, "Wacom Tablet Area", 4);
+}
+
+QVector<int> parseProductId(const QByteArray& properties)
+{
+	return parseProperty(properties, "Device Product ID", 2);
+}
+
+int runCommand(const QString& command, QTextStream& out, QByteArray* output)
+{
+	QProcess pro;
+	out << "> " << command << endl;
+	pro.start(command);
+	if (!pro.waitForFinished(COMMAND_TIMEOUT)) {
+		out << command.section(' ', 0, 0) << " : " << pro.errorString() << endl;
+		pro.kill();
+		return -1;
+	}
+	QByteArray stdout_data = pro.readAllStandardOutput();
+	out << stdout_data;
+	out << pro.readAllStandardError() << flush;
+	if (output) *output = stdout_data;
+	return pro.exitCode();
+}
+
+int runCommands(const QStringList& commands, QTextStream& out)
+{
+	QVector<QProcess*> processes;
+	for (const QString& command : commands) {
+		out << "> " << command << endl;
+		QProcess* pro = new QProcess();
+		pro->start(command);
+		processes << pro;
+	}
+
+	int failures = 0;
+	for (int i = 0; i < processes.size(); ++i) {
+		QProcess* pro = processes[i];
+		if (!pro->waitForFinished(COMMAND_TIMEOUT)) {
+			out << commands[i].section(' ', 0, 0) << " : " << pro->errorString() << endl;
+			pro->kill();
+			pro->waitForFinished(100);
+			failures++;
+		} else {
+			out << pro->readAllStandardOutput();
+			out << pro->readAllStandardError() << flush;
+			if (pro->exitCode() != 0) failures++;
+		}
+		delete pro;
+	}
+	return failures;
+}
@@ -0,0 +1,38 @@
+#ifndef PROPERTIES_H
+#define PROPERTIES_H
+
+#include <QString>
+#include <QVector>
+#include <QByteArray>
+#include <QStringList>
+#include <QTextStream>
+
+/* xinput command lines that set the properties of the patched driver
+ * area : TopX, TopY, BottomX, BottomY
+ * distortion : 4x[border width, x^4, x^3, x^2, x, 1]
+ * table : entries corrected x followed by entries corrected y
+ */
+QString resetDistortionTableCommand(const QString& device);
+QString listPropertiesCommand(const QString& device);
+QString areaCommand(const QString& device, const QVector<int>& area);
+QString distortionCommand(const QString& device, const QVector<double>& distortion);
+QString distortionTableCommand(const QString& device, int entries, const QVector<int>& table);
+
+// "Wacom Tablet Area" in the output of xinput list-props, empty if not found
+QVector<int> parseArea(const QByteArray& properties);
+// "Device Product ID" : vendor, product, empty if not found
+QVector<int> parseProductId(const QByteArray& properties);
+
+// milliseconds before a command is killed
+#define COMMAND_TIMEOUT 5000
+
+/* echo the command and its outputs in out, return the exit code
+ * (-1 if it could not start or timed out)
+ * output receives the standard output if not null
+ */
+int runCommand(const QString& command, QTextStream& out, QByteArray* output = 0);
+
+// start all the commands at once, return the number of them that failed
+int runCommands(const QStringList& commands, QTextStream& out);
+
+#endif // PROPERTIES_H
@@ -0,0 +1,78 @@
+#include "propertyqueue.hh"
+
+PropertyWorker::PropertyWorker(bool native)
+{
+	m_backend = 0;
+	m_native = native;
+}
+
+PropertyWorker::~PropertyWorker()
+{
+	delete m_backend;
+}
+
+void PropertyWorker::run(const PropertyRequest& request)
+{
+	if (!m_backend) m_backend = DeviceBackend::create(m_native, false);
+
+	PropertyResult result;
+	result.id = request.id;
+
+	PropertyWrites writes = request.writes;
+	if (!request.productId.isEmpty()) {
+		result.productId = m_backend->productId(request.device);
+		result.matched = result.productId == request.productId;
+		// another tablet behind the same name
+		if (!result.matched) writes.area.clear();
+	}
+
+	result.ok = m_backend->write(request.device, writes);
+	if (request.probe) {
+		if (result.ok && result.matched) {
+			// nothing to read, the area is the one just written
+			result.area = writes.area;
+		} else {
+			result.area = m_backend->area(request.device);
+			if (result.productId.isEmpty()) result.productId = m_backend->productId(request.device);
+			if (!result.ok) result.devices = m_backend->devices();
+		}
+	}
+	emit done(result);
+}
+
+PropertyQueue::PropertyQueue(bool native, QObject* parent) : QObject(parent)
+{
+	qRegisterMetaType<PropertyRequest>("PropertyRequest");
+	qRegisterMetaType<PropertyResult>("PropertyResult");
+
+	m_nextId = 1;
+	m_pending = 0;
+
+	PropertyWorker* worker = new PropertyWorker(native);
+	worker->moveToThread(&m_thread);
+	connect(&m_thread, &QThread::finished, worker, &QObject::deleteLater);
+	connect(this, &PropertyQueue::queued, worker, &PropertyWorker::run);
+	connect(worker, &PropertyWorker::done, this, &PropertyQueue::workerDone);
+	m_thread.start();
+}
+
+PropertyQueue::~PropertyQueue()
+{
+	// the request being run completes, the ones still queued are dropped
+	m_thread.quit();
+	m_thread.wait();
+}
+
+int PropertyQueue::submit(PropertyRequest request)
+{
+	request.id = m_nextId++;
+	m_pending++;
+	emit queued(request);
+	return request.id;
+}
+
+void PropertyQueue::workerDone(const PropertyResult& result)
+{
+	m_pending--;
+	emit finished(result);
+}
@@ -0,0 +1,87 @@
+#ifndef PROPERTYQUEUE_H
+#define PROPERTYQUEUE_H
+
+#include <QObject>
+#include <QThread>
+#include <QMetaType>
+
+#include "devicebackend.hh"
+
+/* What a step asks to the driver : the writes first, then the reads */
+struct PropertyRequest {
+	PropertyRequest() : id(0), probe(false) {}
+
+	int id; // set by PropertyQueue::submit
+	QString device;
+	PropertyWrites writes;
+	bool probe; // read the area, and list the devices if the writes failed
+	// if not empty, the device must have this product id else writes.area is not written
+	QVector<int> productId;
+};
+
+struct PropertyResult {
+	PropertyResult() : id(0), ok(false), matched(false) {}
+
+	int id;
+	bool ok; // all the writes succeeded
+	bool matched; // the device has the product id of the request
+	QVector<int> area; // read, or the one written if matched
+	QVector<int> productId; // read if probe or if the request has one
+	QStringList devices;
+};
+
+Q_DECLARE_METATYPE(PropertyRequest)
+Q_DECLARE_METATYPE(PropertyResult)
+
+// lives in the thread of PropertyQueue, the backend is created there
+class PropertyWorker : public QObject
+{
+	Q_OBJECT
+public:
+	explicit PropertyWorker(bool native);
+	~PropertyWorker();
+
+public slots:
+	void run(const PropertyRequest& request);
+
+signals:
+	void done(const PropertyResult& result);
+
+private:
+	DeviceBackend* m_backend;
+	bool m_native;
+};
+
+/* Runs the requests in order on a worker thread, so that the GUI thread never
+ * waits for xinput nor for the X server
+ * native : see DeviceBackend::create, the worker uses its own X connection
+ */
+class PropertyQueue : public QObject
+{
+	Q_OBJECT
+public:
+	explicit PropertyQueue(bool native, QObject* parent = 0);
+	~PropertyQueue();
+
+	// return the id of the request, given back with finished()
+	int submit(PropertyRequest request);
+
+	// some requests are not finished
+	inline bool busy() const { return m_pending > 0; }
+
+signals:
+	void finished(const PropertyResult& result);
+
+	// to the worker
+	void queued(const PropertyRequest& request);
+
+private slots:
+	void workerDone(const PropertyResult& result);
+
+private:
+	QThread m_thread;
+	int m_nextId;
+	int m_pending;
+};
+
+#endif // PROPERTYQUEUE_H
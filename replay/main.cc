@@ -0,0 +1,266 @@
+#include "calibrationengine.hh"
+#include "session.hh"
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QThreadPool>
+#include <QTextStream>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+/* Replay a session recorded with wacom-distortion --record through the
+ * calibration engine, without display nor device
+ * report the throughput, the latency of the events that fit the curves
+ * and the values the calibration would have uploaded
+ */
+
+// nearest rank, sorted must not be empty
+static qint64 percentile(const QVector<qint64>& sorted, double p)
+{
+	int i = qBound(0, int(p / 100.0 * sorted.size() + 0.5) - 1, sorted.size() - 1);
+	return sorted[i];
+}
+
+// the points given to the fits of the curves
+static int fittedPoints(const CalibrationEngine& engine)
+{
+	int points = 0;
+	for (const CalibrationEngine::Curve& c : engine.curves()) {
+		points += engine.resampleSpacing() > 0.0 ? c.samples.size() : c.pts.size();
+	}
+	return points;
+}
+
+/* return the points fitted when the distortion calibration ends, or at the end of the session
+ * autoLimits : search the border limits even if the session did not
+ */
+static int replay(CalibrationEngine& engine, const SessionHeader& header, const QVector<SessionEvent>& events,
+						QVector<qint64>& fit_ns, double spacing = 0.0, bool autoLimits = false)
+{
+	startSession(engine, header);
+	engine.setResampleSpacing(spacing);
+	if (autoLimits) engine.setAutoLimits(true);
+
+	int points = -1;
+	QElapsedTimer clock;
+	for (const SessionEvent& e : events) {
+		if (e.type == SessionEvent::Step && engine.fitMode()) points = fittedPoints(engine);
+		clock.start();
+		if (replayEvent(engine, e)) fit_ns << clock.nsecsElapsed();
+	}
+	return points < 0 ? fittedPoints(engine) : points;
+}
+
+/* the engine as it is when the distortion calibration ends, with the strokes
+ * drawn during the calibration drawn copies times
+ * return false if the session does not get there
+ */
+static bool fitState(CalibrationEngine& engine, const SessionHeader& header, const QVector<SessionEvent>& events, int copies)
+{
+	startSession(engine, header);
+
+	QVector<SessionEvent> strokes;
+	for (const SessionEvent& e : events) {
+		if (e.type == SessionEvent::Step && engine.fitMode()) break;
+		bool fitting = engine.fitMode();
+		replayEvent(engine, e);
+		if (fitting && e.type <= SessionEvent::TabletRelease && !e.eraser()) strokes << e;
+	}
+	if (!engine.fitMode()) return false;
+
+	for (int k = 1; k < copies; ++k) {
+		for (const SessionEvent& e : strokes) replayEvent(engine, e);
+	}
+	return true;
+}
+
+// the first fitCurves() of a copy of base repeat times (it indexes the curves), return the mean in nanoseconds
+static qint64 timeFirstFit(const CalibrationEngine& base, CalibrationEngine& engine, int repeat)
+{
+	QElapsedTimer clock;
+	qint64 ns = 0;
+	for (int r = 0; r < repeat; ++r) {
+		engine = base;
+		clock.start();
+		engine.fitCurves();
+		ns += clock.nsecsElapsed();
+	}
+	return ns / repeat;
+}
+
+// a border limit dragged by one pixel back and forth, the curves indexed, return the mean in nanoseconds
+static qint64 timeLimitMoves(CalibrationEngine& engine, int repeat)
+{
+	double pos = engine.borderLimit(0).pos;
+	QElapsedTimer clock;
+	clock.start();
+	for (int r = 0; r < repeat; ++r) engine.moveBorderLimit(0, pos + (r % 2 ? 0.0 : 1.0));
+	qint64 ns = clock.nsecsElapsed() / repeat;
+	engine.moveBorderLimit(0, pos);
+	return ns;
+}
+
+int main(int argc, char *argv[])
+{
+	QCoreApplication app(argc, argv);
+	app.setApplicationName("wacom-replay");
+
+	QCommandLineParser parser;
+	parser.setApplicationDescription("Replay a session recorded with wacom-distortion --record");
+	parser.addHelpOption();
+	parser.addPositionalArgument("session", "Recorded session");
+	QCommandLineOption repeatOption("repeat", "Replay the session <count> times (default 1)", "count", "1");
+	parser.addOption(repeatOption);
+	QCommandLineOption resampleOption("resample", "Compare with the fits of the curves resampled every <pixels>, as wacom-distortion --resample, can be repeated", "pixels");
+	parser.addOption(resampleOption);
+	QCommandLineOption autoLimitsOption("auto-limits", "Place the border limits where the lines are fitted the best, as wacom-distortion --auto-limits");
+	parser.addOption(autoLimitsOption);
+	QCommandLineOption scalingOption("scaling", "Time the fits of all the curves on one core and on all of them, and the limit moves, with the strokes drawn up to <count> times", "count");
+	parser.addOption(scalingOption);
+	parser.process(app);
+
+	QTextStream cout(stdout);
+	QTextStream cerr(stderr);
+
+	if (parser.positionalArguments().size() != 1) parser.showHelp(1);
+
+	SessionHeader header;
+	QVector<SessionEvent> events;
+	QString error;
+	if (!readSession(parser.positionalArguments()[0], header, events, &error)) {
+		cerr << parser.positionalArguments()[0] << " : " << error << endl;
+		return 1;
+	}
+	int repeat = qMax(1, parser.value(repeatOption).toInt());
+	bool autoLimits = parser.isSet(autoLimitsOption);
+
+	cout << "Screen " << header.w << "x" << header.h << ", rotation " << header.rotation
+		  << ", area " << header.area[0] << " " << header.area[1] << " " << header.area[2] << " " << header.area[3] << endl;
+	cout << events.size() << " events";
+	if (!events.isEmpty()) cout << " over " << events.last().time / 1e6 << " s";
+	cout << endl;
+
+	CalibrationEngine engine;
+	QVector<qint64> fit_ns;
+	QElapsedTimer clock;
+	clock.start();
+	for (int r = 0; r < repeat; ++r) replay(engine, header, events, fit_ns, 0.0, autoLimits);
+	qint64 total_ns = clock.nsecsElapsed();
+
+	double seconds = total_ns / 1e9;
+	cout << "Replayed " << repeat << " time(s) in " << seconds * 1e3 << " ms : "
+		  << qint64(events.size() * repeat / qMax(seconds, 1e-9)) << " events/s" << endl;
+
+	if (!fit_ns.isEmpty()) {
+		std::sort(fit_ns.begin(), fit_ns.end());
+		cout << "Fit latency (us) over " << fit_ns.size() << " fits :"
+			  << " p50 " << percentile(fit_ns, 50) / 1e3
+			  << " p90 " << percentile(fit_ns, 90) / 1e3
+			  << " p99 " << percentile(fit_ns, 99) / 1e3
+			  << " max " << fit_ns.last() / 1e3 << endl;
+	}
+
+	cout << "Final state " << engine.state() << endl;
+	if (engine.state() >= 2) {
+		const QVector<int>& area = engine.area();
+		cout << "Wacom Tablet Area : " << area[0] << " " << area[1] << " " << area[2] << " " << area[3] << endl;
+	}
+	if (engine.state() >= 3) {
+		const QVector<double>& values = engine.distortion();
+		cout << "Wacom Border Distortion :";
+		for (double v : values) cout << QString(" %1").arg(v, 0, 'g', 17);
+		cout << endl;
+
+		const QVector<double>& errors = engine.quantizationErrors();
+		for (int b = 0; b < 4; ++b) {
+			cout << "Border " << b << " : worst quantization error " << errors[b] << " (" << errors[b] * engine.wh(b) << " pixels)" << endl;
+		}
+	} else {
+		// the session ended during the distortion calibration, give the current limits and fits
+		cout << "Border limits (pixels) :";
+		for (int b = 0; b < 4; ++b) cout << " " << engine.borderLimit(b).pos;
+		cout << endl;
+		const QList<CalibrationEngine::Curve>& curves = engine.curves();
+		for (int i = 0; i < curves.size(); ++i) {
+			const CalibrationEngine::Curve& c = curves[i];
+			if (c.border == -1) continue;
+			cout << "Curve " << i << " border " << c.border << " :";
+			for (int j = 0; j < 5; ++j) cout << QString(" %1").arg(c.poly[j], 0, 'g', 17);
+			cout << endl;
+		}
+	}
+
+	// speed and accuracy of the resampling, against the fits of all the samples
+	QStringList spacings = parser.values(resampleOption);
+	if (!spacings.isEmpty()) {
+		const int entries = 1024;
+		QVector<int> reference;
+		if (engine.state() >= 3) reference = engine.distortionTable(entries);
+
+		cout << endl << "Resampling : spacing (pixels), points fitted, events/s, fit p50 p99 (us)";
+		if (!reference.isEmpty()) cout << ", max difference of the " << entries << " entries table (tablet units)";
+		cout << endl;
+
+		for (int k = -1; k < spacings.size(); ++k) {
+			double spacing = k < 0 ? 0.0 : spacings[k].toDouble();
+			QVector<qint64> ns;
+			int points = 0;
+			clock.start();
+			for (int r = 0; r < repeat; ++r) points = replay(engine, header, events, ns, spacing, autoLimits);
+			double s = clock.nsecsElapsed() / 1e9;
+			std::sort(ns.begin(), ns.end());
+
+			cout << spacing << " " << points << " " << qint64(events.size() * repeat / qMax(s, 1e-9)) << " ";
+			if (!ns.isEmpty()) cout << percentile(ns, 50) / 1e3 << " " << percentile(ns, 99) / 1e3;
+			if (!reference.isEmpty() && engine.state() >= 3) {
+				QVector<int> table = engine.distortionTable(entries);
+				int diff = 0;
+				for (int i = 0; i < table.size(); ++i) diff = qMax(diff, std::abs(table[i] - reference[i]));
+				cout << " " << diff;
+			}
+			cout << endl;
+		}
+	}
+
+	// speedup of the fits of all the curves (a border limit moved) with the number of curves
+	if (parser.isSet(scalingOption)) {
+		int copies = qMax(1, parser.value(scalingOption).toInt());
+		QThreadPool* pool = QThreadPool::globalInstance();
+		int threads = pool->maxThreadCount();
+
+		cout << endl << "Fits of all the curves on " << threads << " threads : copies, curves, points, first fit on 1 thread (us), "
+			  << threads << " threads (us), speedup, then a limit move (us)" << endl;
+		CalibrationEngine base;
+		for (int k = 1; k <= copies; k *= 2) {
+			if (!fitState(base, header, events, k)) {
+				cout << "the session does not reach the end of the distortion calibration" << endl;
+				break;
+			}
+			int points = 0;
+			for (const CalibrationEngine::Curve& c : base.curves()) points += c.pts.size();
+
+			pool->setMaxThreadCount(1);
+			qint64 serial = timeFirstFit(base, engine, repeat);
+			QList<CalibrationEngine::Curve> reference = engine.curves();
+			pool->setMaxThreadCount(threads);
+			qint64 parallel = timeFirstFit(base, engine, repeat);
+			qint64 move = timeLimitMoves(engine, qMax(repeat, 100));
+
+			// the same fits, whatever the threads
+			bool same = true;
+			for (int i = 0; i < reference.size(); ++i) {
+				const CalibrationEngine::Curve& a = reference[i];
+				const CalibrationEngine::Curve& b = engine.curves()[i];
+				same = same && a.border == b.border && !memcmp(a.poly, b.poly, sizeof a.poly) && !memcmp(a.ab, b.ab, sizeof a.ab);
+			}
+
+			cout << k << " " << engine.curves().size() << " " << points << " " << serial / 1e3 << " " << parallel / 1e3
+				  << " " << double(serial) / qMax<qint64>(parallel, 1) << " " << move / 1e3;
+			if (!same) cout << " (different fits)";
+			cout << endl;
+		}
+	}
+
+	return 0;
+}
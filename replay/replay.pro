@@ -0,0 +1,16 @@
+#-------------------------------------------------
+#
+# Headless replay of a recorded calibration session
+#
+#-------------------------------------------------
+
+QT       = core
+CONFIG   += console c++11
+CONFIG   -= app_bundle
+
+TARGET = wacom-replay
+TEMPLATE = app
+
+include(../calibrationengine.pri)
+
+SOURCES += main.cc
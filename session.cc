@@ -0,0 +1,248 @@
+#include "session.hh"
+#include "calibrationengine.hh"
+
+#define SESSION_MAGIC 0x57445352 // "WDSR"
+#define SESSION_VERSION 1
+
+SessionRecorder::SessionRecorder()
+{
+	m_last = 0;
+}
+
+SessionRecorder::~SessionRecorder()
+{
+	close();
+}
+
+bool SessionRecorder::open(const QString& path, const SessionHeader& header)
+{
+	close();
+
+	m_file.setFileName(path);
+	if (!m_file.open(QIODevice::WriteOnly | QIODevice::Truncate)) return false;
+
+	m_stream.setDevice(&m_file);
+	m_stream.setVersion(QDataStream::Qt_5_0);
+	m_stream.setByteOrder(QDataStream::LittleEndian);
+
+	m_stream << quint32(SESSION_MAGIC) << quint16(SESSION_VERSION);
+	m_stream << header.w << header.h << qint8(header.rotation);
+	for (int i = 0; i < 4; ++i) m_stream << qint32(header.area.value(i));
+
+	// the positions are recorded in single precision
+	m_stream.setFloatingPointPrecision(QDataStream::SinglePrecision);
+
+	m_clock.start();
+	m_last = 0;
+	return true;
+}
+
+void SessionRecorder::close()
+{
+	if (m_file.isOpen()) {
+		m_stream.setDevice(0);
+		m_file.close();
+	}
+}
+
+void SessionRecorder::record(const SessionEvent& event)
+{
+	if (!m_file.isOpen()) return;
+
+	qint64 now = m_clock.nsecsElapsed() / 1000;
+	m_stream << quint8(event.type) << quint32(qMin<qint64>(now - m_last, 0xffffffff));
+	m_last = now;
+
+	switch (event.type) {
+		case SessionEvent::TabletPress:
+		case SessionEvent::TabletMove:
+		case SessionEvent::TabletRelease:
+			m_stream << event.pos.x() << event.pos.y();
+			m_stream << quint8(event.pointer) << quint8(event.buttons) << quint8(event.flags);
+			break;
+		case SessionEvent::LimitMove:
+			m_stream << quint8(event.border) << event.pos.x();
+			break;
+		case SessionEvent::AutoLimits:
+			m_stream << quint8(event.flags);
+			break;
+		default:
+			// keep what is recorded when the session ends abruptly
+			m_file.flush();
+			break;
+	}
+}
+
+void SessionRecorder::tablet(int type, const QPointF& pos, int pointer, int buttons, int flags)
+{
+	SessionEvent e;
+	e.type = type;
+	e.pos = pos;
+	e.pointer = pointer;
+	e.buttons = buttons;
+	e.flags = flags;
+	e.border = -1;
+	record(e);
+}
+
+void SessionRecorder::limitMove(int border, double pos)
+{
+	SessionEvent e;
+	e.type = SessionEvent::LimitMove;
+	e.pos = QPointF(pos, 0.0);
+	e.pointer = 0;
+	e.buttons = 0;
+	e.flags = 0;
+	e.border = border;
+	record(e);
+}
+
+void SessionRecorder::autoLimits(bool enabled)
+{
+	SessionEvent e;
+	e.type = SessionEvent::AutoLimits;
+	e.pointer = 0;
+	e.buttons = 0;
+	e.flags = enabled ? 1 : 0;
+	e.border = -1;
+	record(e);
+}
+
+void SessionRecorder::action(int type)
+{
+	SessionEvent e;
+	e.type = type;
+	e.pointer = 0;
+	e.buttons = 0;
+	e.flags = 0;
+	e.border = -1;
+	record(e);
+}
+
+bool readSession(const QString& path, SessionHeader& header, QVector<SessionEvent>& events, QString* error)
+{
+	QFile file(path);
+	if (!file.open(QIODevice::ReadOnly)) {
+		if (error) *error = file.errorString();
+		return false;
+	}
+
+	QDataStream stream(&file);
+	stream.setVersion(QDataStream::Qt_5_0);
+	stream.setByteOrder(QDataStream::LittleEndian);
+
+	quint32 magic;
+	quint16 version;
+	qint8 rotation;
+	stream >> magic >> version;
+	if (magic != SESSION_MAGIC || version != SESSION_VERSION) {
+		if (error) *error = "not a session recording";
+		return false;
+	}
+	stream >> header.w >> header.h >> rotation;
+	header.rotation = rotation;
+	header.area.clear();
+	for (int i = 0; i < 4; ++i) {
+		qint32 v;
+		stream >> v;
+		header.area << v;
+	}
+	stream.setFloatingPointPrecision(QDataStream::SinglePrecision);
+
+	events.clear();
+	qint64 time = 0;
+	while (stream.status() == QDataStream::Ok && !stream.atEnd()) {
+		quint8 type, pointer, buttons, flags, border;
+		quint32 dt;
+		double x, y;
+		stream >> type >> dt;
+
+		SessionEvent e;
+		e.type = type;
+		e.time = time += dt;
+		e.pointer = 0;
+		e.buttons = 0;
+		e.flags = 0;
+		e.border = -1;
+
+		switch (type) {
+			case SessionEvent::TabletPress:
+			case SessionEvent::TabletMove:
+			case SessionEvent::TabletRelease:
+				stream >> x >> y >> pointer >> buttons >> flags;
+				e.pos = QPointF(x, y);
+				e.pointer = pointer;
+				e.buttons = buttons;
+				e.flags = flags;
+				break;
+			case SessionEvent::LimitMove:
+				stream >> border >> x;
+				e.border = border;
+				e.pos = QPointF(x, 0.0);
+				break;
+			case SessionEvent::AutoLimits:
+				stream >> flags;
+				e.flags = flags;
+				break;
+			case SessionEvent::Step:
+			case SessionEvent::Clear:
+			case SessionEvent::Undo:
+				break;
+			default:
+				if (error) *error = QString("unknown record type %1").arg(type);
+				return false;
+		}
+
+		// a truncated last record is dropped
+		if (stream.status() == QDataStream::Ok) events << e;
+	}
+	return true;
+}
+
+void startSession(CalibrationEngine& engine, const SessionHeader& header)
+{
+	engine = CalibrationEngine();
+	engine.setScreenSize(header.w, header.h);
+	engine.setArea(header.area);
+	engine.setRotation(header.rotation);
+	engine.clearAll();
+	engine.nextStep();
+}
+
+bool replayEvent(CalibrationEngine& engine, const SessionEvent& event)
+{
+	bool hover = event.flags & SessionEvent::LimitHover;
+	bool fit = false;
+
+	switch (event.type) {
+		case SessionEvent::TabletPress:
+			engine.tabletPress(event.pos, event.eraser());
+			break;
+		case SessionEvent::TabletMove:
+			fit = engine.fitMode() && !event.eraser() && !hover;
+			engine.tabletMove(event.pos, event.time, event.eraser(), hover);
+			break;
+		case SessionEvent::TabletRelease:
+			engine.tabletRelease();
+			break;
+		case SessionEvent::LimitMove:
+			if (engine.fitMode() && event.border >= 0 && event.border < 4) {
+				engine.moveBorderLimit(event.border, event.pos.x());
+				fit = true;
+			}
+			break;
+		case SessionEvent::Step:
+			engine.nextStep();
+			break;
+		case SessionEvent::Clear:
+			engine.clearAll();
+			break;
+		case SessionEvent::Undo:
+			engine.undo();
+			break;
+		case SessionEvent::AutoLimits:
+			engine.setAutoLimits(event.flags != 0);
+			break;
+	}
+	return fit;
+}
@@ -0,0 +1,93 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <QFile>
+#include <QDataStream>
+#include <QElapsedTimer>
+#include <QPointF>
+#include <QVector>
+#include <QString>
+
+/* Recording of a calibration session
+ *
+ * header : "WDSR", version (16 bits), screen width and height (double),
+ *          rotation (8 bits), area TopX TopY BottomX BottomY (32 bits)
+ *          as they are when the linear calibration begins
+ * then one record per event :
+ *   type (8 bits), time since the previous record in microseconds (32 bits)
+ *   TabletPress/Move/Release : global x, y (float), pointer type, buttons, flags (8 bits)
+ *   LimitMove : border (8 bits), new position (float)
+ *   Step, Clear, Undo : nothing
+ *   AutoLimits : enabled (8 bits)
+ */
+
+struct SessionHeader {
+	double w, h;
+	int rotation;
+	QVector<int> area;
+};
+
+struct SessionEvent {
+	enum Type {
+		TabletPress = 0,
+		TabletMove,
+		TabletRelease,
+		LimitMove,
+		Step,    // Ok button or Enter
+		Clear,   // Delete key
+		Undo,    // Backspace key
+		AutoLimits // see CalibrationEngine::setAutoLimits
+	};
+	enum Flags {
+		LimitHover = 1 // a border limit is under the pointer or grabbed
+	};
+
+	int type;
+	qint64 time; // microseconds since the beginning of the recording
+	QPointF pos; // tablet events : global position, LimitMove : x is the new position
+	int pointer; // QTabletEvent::PointerType
+	int buttons; // Qt::MouseButtons
+	int flags;   // tablet events : Flags, AutoLimits : 1 if enabled
+	int border;  // LimitMove
+
+	// same test as CalibrationWidget::tabletEvent (3 is QTabletEvent::Eraser)
+	inline bool eraser() const { return pointer == 3 || buttons == Qt::RightButton; }
+};
+
+class SessionRecorder
+{
+public:
+	SessionRecorder();
+	~SessionRecorder();
+
+	bool open(const QString& path, const SessionHeader& header);
+	inline bool isOpen() const { return m_file.isOpen(); }
+	void close();
+
+	// the time of the event is set by the recorder
+	void record(const SessionEvent& event);
+
+	void tablet(int type, const QPointF& pos, int pointer, int buttons, int flags);
+	void limitMove(int border, double pos);
+	void autoLimits(bool enabled);
+	void action(int type);
+
+private:
+	QFile m_file;
+	QDataStream m_stream;
+	QElapsedTimer m_clock;
+	qint64 m_last;
+};
+
+// return false and set error if the file can not be read
+bool readSession(const QString& path, SessionHeader& header, QVector<SessionEvent>& events, QString* error = 0);
+
+class CalibrationEngine;
+
+// reset the engine as it is when the recording begins (start of the linear calibration)
+void startSession(CalibrationEngine& engine, const SessionHeader& header);
+
+// feed one recorded event to the engine, return true if curves have been fitted
+bool replayEvent(CalibrationEngine& engine, const SessionEvent& event);
+
+#endif // SESSION_H
@@ -0,0 +1,68 @@
+#include "strokegrid.hh"
+#include <algorithm>
+#include <cmath>
+
+StrokeGrid::StrokeGrid(double cellSize)
+{
+	m_cellSize = cellSize;
+}
+
+void StrokeGrid::clear()
+{
+	m_cells.clear();
+	m_curveCells.clear();
+}
+
+int StrokeGrid::cell(double v) const
+{
+	return int(std::floor(v / m_cellSize));
+}
+
+quint64 StrokeGrid::key(int cx, int cy)
+{
+	return (quint64(quint32(cx)) << 32) | quint32(cy);
+}
+
+void StrokeGrid::insert(int id, const QPointF& point)
+{
+	quint64 k = key(cell(point.x()), cell(point.y()));
+	Entry e = { id, point };
+	m_cells[k].append(e);
+
+	// the consecutive points of a curve are mostly in the same cell
+	QVector<quint64>& cells = m_curveCells[id];
+	if (cells.isEmpty() || cells.last() != k) cells.append(k);
+}
+
+void StrokeGrid::remove(int id)
+{
+	QHash<int, QVector<quint64>>::iterator c = m_curveCells.find(id);
+	if (c == m_curveCells.end()) return;
+
+	for (quint64 k : c.value()) {
+		QHash<quint64, QVector<Entry>>::iterator it = m_cells.find(k);
+		if (it == m_cells.end()) continue; // already emptied, a cell can be listed twice
+		QVector<Entry>& entries = it.value();
+		entries.erase(std::remove_if(entries.begin(), entries.end(), [id](const Entry& e) { return e.id == id; }),
+						  entries.end());
+		if (entries.isEmpty()) m_cells.erase(it);
+	}
+	m_curveCells.erase(c);
+}
+
+QVector<int> StrokeGrid::hits(const QPointF& pos, double radius) const
+{
+	QVector<int> ids;
+	int cx = cell(pos.x());
+	int cy = cell(pos.y());
+	for (int i = cx - 1; i <= cx + 1; ++i) {
+		for (int j = cy - 1; j <= cy + 1; ++j) {
+			QHash<quint64, QVector<Entry>>::const_iterator it = m_cells.find(key(i, j));
+			if (it == m_cells.end()) continue;
+			for (const Entry& e : it.value()) {
+				if ((e.point - pos).manhattanLength() <= radius && !ids.contains(e.id)) ids << e.id;
+			}
+		}
+	}
+	return ids;
+}
@@ -0,0 +1,40 @@
+#ifndef STROKEGRID_H
+#define STROKEGRID_H
+
+#include <QHash>
+#include <QVector>
+#include <QPointF>
+
+/* Uniform grid over the points of the curves, for the eraser
+ * a point goes in the cell of cellSize x cellSize pixels that contains it,
+ * a hit test within radius <= cellSize looks only at the 3x3 cells around
+ * the curves are given by an id that does not change when others are removed
+ */
+class StrokeGrid
+{
+public:
+	explicit StrokeGrid(double cellSize = 8.0);
+
+	void clear();
+	void insert(int id, const QPointF& point);
+	// all the points of the curve
+	void remove(int id);
+
+	// ids of the curves having a point at a manhattan distance <= radius of pos, once each
+	QVector<int> hits(const QPointF& pos, double radius) const;
+
+private:
+	struct Entry {
+		int id;
+		QPointF point;
+	};
+
+	int cell(double v) const;
+	static quint64 key(int cx, int cy);
+
+	double m_cellSize;
+	QHash<quint64, QVector<Entry>> m_cells;
+	QHash<int, QVector<quint64>> m_curveCells; // the cells of each curve
+};
+
+#endif // STROKEGRID_H
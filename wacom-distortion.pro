@@ -12,14 +12,32 @@ greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 TARGET = wacom-distortion
 TEMPLATE = app
 
+include(calibrationengine.pri)
 
 SOURCES += main.cc\
-    lmath.c \
+    batch.cc \
+    devicebackend.cc \
+    propertyqueue.cc \
+    devicecache.cc \
+    fitworker.cc \
     calibrationwidget.cc
 
 HEADERS  += \
-    lmath.h \
+    batch.hh \
+    devicebackend.hh \
+    propertyqueue.hh \
+    devicecache.hh \
+    fitworker.hh \
     calibrationwidget.hh
 
+# native XInput 2 backend, the xinput program is used otherwise
+packagesExist(xi x11):qtHaveModule(x11extras) {
+    DEFINES += HAVE_XI
+    QT += x11extras
+    LIBS += -lXi -lX11
+    SOURCES += xibackend.cc
+    HEADERS += xibackend.hh
+}
+
 DISTFILES += \
     README.md
@@ -0,0 +1,193 @@
+#include "xibackend.hh"
+#include <QHash>
+#include <QMutex>
+#include <X11/Xlib.h>
+#include <X11/Xatom.h>
+#include <X11/extensions/XInput2.h>
+#include <X11/Xlibint.h>
+
+// errors of the requests sent by a write(), from its first request on
+struct ErrorTrap {
+	unsigned long first;
+	int error;
+};
+
+// the traps of the writes in progress, by connection
+static QMutex s_trapsMutex;
+static QHash<Display*, ErrorTrap> s_traps;
+
+// error hook of the connection (XESetError), called before the global handler
+// of Xlib which is not called if the hook returns nonzero
+static int errorHook(Display* display, xError* error, XExtCodes* codes, int* ret)
+{
+	Q_UNUSED(codes);
+	QMutexLocker lock(&s_trapsMutex);
+	QHash<Display*, ErrorTrap>::iterator trap = s_traps.find(display);
+	// Xlib already extended the 16 bit sequence number of the error
+	if (trap == s_traps.end() || LastKnownRequestProcessed(display) < trap->first) return 0;
+
+	if (trap->error == 0) trap->error = error->errorCode;
+	*ret = 0;
+	return 1;
+}
+
+XiBackend::XiBackend(Display* display)
+{
+	m_ownDisplay = display == 0;
+	m_display = m_ownDisplay ? XOpenDisplay(0) : display;
+	if (!m_display) return;
+
+	// a shared connection already negotiated its XInput version with the server
+	int opcode, event, error;
+	int major = 2, minor = 0;
+	if (!XQueryExtension(m_display, "XInputExtension", &opcode, &event, &error) ||
+		 (m_ownDisplay && XIQueryVersion(m_display, &major, &minor) != Success)) {
+		if (m_ownDisplay) XCloseDisplay(m_display);
+		m_display = 0;
+		return;
+	}
+
+	// the errors are trapped on this connection only, the process wide
+	// XSetErrorHandler would also catch the ones of the other threads
+	XExtCodes* codes = XAddExtension(m_display);
+	if (codes) XESetError(m_display, codes->extension, errorHook);
+}
+
+XiBackend::~XiBackend()
+{
+	if (m_display && m_ownDisplay) XCloseDisplay(m_display);
+}
+
+QStringList XiBackend::devices()
+{
+	QStringList devices;
+	int count;
+	XIDeviceInfo* info = XIQueryDevice(m_display, XIAllDevices, &count);
+	for (int i = 0; i < count; ++i) {
+		// the styli are slave pointers, attached or not
+		if (info[i].use == XISlavePointer || info[i].use == XIFloatingSlave) devices << QString::fromLocal8Bit(info[i].name);
+	}
+	XIFreeDeviceInfo(info);
+	return devices;
+}
+
+int XiBackend::deviceId(const QString& device)
+{
+	bool isId;
+	int id = device.toInt(&isId);
+
+	int res = -1;
+	int count;
+	XIDeviceInfo* info = XIQueryDevice(m_display, XIAllDevices, &count);
+	for (int i = 0; i < count && res == -1; ++i) {
+		if (QString::fromLocal8Bit(info[i].name) == device || (isId && info[i].deviceid == id)) res = info[i].deviceid;
+	}
+	XIFreeDeviceInfo(info);
+	return res;
+}
+
+QVector<int> XiBackend::property(const QString& device, const char* name, int count)
+{
+	QVector<int> values;
+	int id = deviceId(device);
+	Atom property = XInternAtom(m_display, name, True);
+	if (id == -1 || property == None) return values;
+
+	Atom type;
+	int format;
+	unsigned long n, after;
+	unsigned char* data = 0;
+	if (XIGetProperty(m_display, id, property, 0, count, False, XA_INTEGER,
+							&type, &format, &n, &after, &data) == Success) {
+		// XInput 2 gives 32 bit items as 32 bit integers
+		if (type == XA_INTEGER && format == 32 && n == (unsigned long)count) {
+			const qint32* v = reinterpret_cast<const qint32*>(data);
+			for (int i = 0; i < count; ++i) values << v[i];
+		}
+		XFree(data);
+	}
+	return values;
+}
+
+QVector<int> XiBackend::area(const QString& device)
+{
+	return property(device, "Wacom Tablet Area", 4);
+}
+
+QVector<int> XiBackend::productId(const QString& device)
+{
+	return property(device, "Device Product ID", 2);
+}
+
+bool XiBackend::send(int id, const char* property, unsigned long type, const void* data, int count)
+{
+	Atom atom = XInternAtom(m_display, property, True);
+	if (atom == None) return false;
+	XIChangeProperty(m_display, id, atom, type, 32, PropModeReplace,
+						  static_cast<unsigned char*>(const_cast<void*>(data)), count);
+	return true;
+}
+
+bool XiBackend::write(const QString& device, const PropertyWrites& writes)
+{
+	int id = deviceId(device);
+	if (id == -1) return false;
+
+	// the requests are queued in the connection and sent together, the driver
+	// checks the values and its errors come back with the single XSync
+	bool ok = true;
+	s_trapsMutex.lock();
+	ErrorTrap& trap = s_traps[m_display];
+	trap.first = NextRequest(m_display);
+	trap.error = 0;
+	s_trapsMutex.unlock();
+
+	if (!writes.distortion.isEmpty()) {
+		Atom float_atom = XInternAtom(m_display, "FLOAT", False);
+		QVector<float> values(writes.distortion.size());
+		for (int i = 0; i < values.size(); ++i) values[i] = writes.distortion[i];
+		ok = send(id, "Wacom Border Distortion", float_atom, values.data(), values.size()) && ok;
+	}
+	if (writes.tableEntries >= 0) {
+		QVector<qint32> values;
+		values << writes.tableEntries << writes.tableEntries;
+		for (int i = 0; i < writes.table.size(); ++i) values << writes.table[i];
+		ok = send(id, "Wacom Border Distortion Table", XA_INTEGER, values.data(), values.size()) && ok;
+	}
+	if (!writes.area.isEmpty()) {
+		qint32 values[4];
+		for (int i = 0; i < 4; ++i) values[i] = writes.area[i];
+		ok = send(id, "Wacom Tablet Area", XA_INTEGER, values, 4) && ok;
+	}
+
+	// the replies of all the requests, and so their errors, are read after the XSync
+	XSync(m_display, False);
+
+	s_trapsMutex.lock();
+	int error = s_traps.take(m_display).error;
+	s_trapsMutex.unlock();
+
+	return ok && error == 0;
+}
+
+bool XiBackend::setArea(const QString& device, const QVector<int>& area)
+{
+	PropertyWrites writes;
+	writes.area = area;
+	return write(device, writes);
+}
+
+bool XiBackend::setDistortion(const QString& device, const QVector<double>& distortion)
+{
+	PropertyWrites writes;
+	writes.distortion = distortion;
+	return write(device, writes);
+}
+
+bool XiBackend::setDistortionTable(const QString& device, int entries, const QVector<int>& table)
+{
+	PropertyWrites writes;
+	writes.tableEntries = entries;
+	writes.table = table;
+	return write(device, writes);
+}
@@ -0,0 +1,43 @@
+#ifndef XIBACKEND_H
+#define XIBACKEND_H
+
+#include "devicebackend.hh"
+
+typedef struct _XDisplay Display;
+
+/* Properties read and written with libXi (XInput 2) on an X connection,
+ * without running xinput nor formatting the values as text
+ */
+class XiBackend : public DeviceBackend
+{
+public:
+	// display : connection to use, 0 to open a connection to $DISPLAY
+	explicit XiBackend(Display* display = 0);
+	~XiBackend();
+
+	// the X server has XInput 2
+	inline bool isValid() const { return m_display != 0; }
+
+	virtual QString name() const override { return "libXi"; }
+	virtual QStringList devices() override;
+	virtual QVector<int> area(const QString& device) override;
+	virtual bool setArea(const QString& device, const QVector<int>& area) override;
+	virtual QVector<int> productId(const QString& device) override;
+	virtual bool setDistortion(const QString& device, const QVector<double>& distortion) override;
+	virtual bool setDistortionTable(const QString& device, int entries, const QVector<int>& table) override;
+	// one round trip for all the writes
+	virtual bool write(const QString& device, const PropertyWrites& writes) override;
+
+private:
+	// -1 if not found
+	int deviceId(const QString& device);
+	// the values of a format 32 integer property, empty if it does not have count of them
+	QVector<int> property(const QString& device, const char* name, int count);
+	// queue the change of a format 32 property, false if the property does not exist
+	bool send(int id, const char* property, unsigned long type, const void* data, int count);
+
+	Display* m_display;
+	bool m_ownDisplay;
+};
+
+#endif // XIBACKEND_H